@@ -228,20 +228,203 @@ const unsigned NumericSequence::symbolsInOneElement = sizeof(unsigned long long)
 #include<set>
 #include<string>
 #include<vector>
+#include<scoped_allocator>
+#include<chrono>
+#include<mutex>
 #include<math.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#include<unistd.h>
 using namespace std;
 
+// Storage for the reference and the k-mer index: the tree nodes and the chromatid strings are carved
+//  out of big anonymous chunks so that they can be backed by huge pages (fewer TLB misses on look-ups)
+//  and, on multi-socket machines, interleaved over all NUMA nodes instead of sitting next to the loader
+class IndexArena {
+public:
+    enum Pages  { SMALL_PAGES = 0, TRANSPARENT_HUGE_PAGES = 1, EXPLICIT_HUGE_PAGES = 2 };
+    enum Policy { LOCAL_NODE  = 0, INTERLEAVE_NODES = 1 };
+
+private:
+    vector< pair<char*,size_t> > chunks; // mapped regions and their sizes
+    char  *current;                      // free space in the last chunk
+    size_t left;
+    Pages  pages;
+    Policy policy;
+
+    const static size_t hugePageSize = 2<<20;  // 2 MB on x86-64
+    const static size_t chunkSize    = 64<<20; // multiple of the huge page size
+
+    // spread the pages of [addr, addr+length) over all online NUMA nodes (no libnuma dependency)
+    static void interleave(void *addr, size_t length){
+        unsigned long nodeMask = 0;
+        FILE *online = fopen("/sys/devices/system/node/online","r");
+        if( online ){
+            // the list looks like "0" or "0-1" or "0,2-3"
+            for(int first=0, last=0, n=0; (n=fscanf(online,"%d-%d",&first,&last))>0; ){
+                if( n==1 ) last = first;
+                for(int node=first; node<=last && node<64; node++) nodeMask |= 0x1UL<<node;
+                if( fgetc(online) != ',' ) break;
+            }
+            fclose(online);
+        }
+        if( nodeMask & (nodeMask-1) ) // more than one node
+            if( syscall(SYS_mbind, addr, length, 3 /*MPOL_INTERLEAVE*/, &nodeMask, 64, 0) != 0 )
+                cerr<<"IndexArena: mbind failed, keeping the default NUMA policy"<<endl;
+    }
+
+    void newChunk(size_t size){
+        size = (size + hugePageSize - 1) / hugePageSize * hugePageSize;
+        void *addr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if( pages == EXPLICIT_HUGE_PAGES ){
+            addr = mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+            if( addr == MAP_FAILED ){
+                cerr<<"IndexArena: no explicit huge pages available, falling back to transparent ones"<<endl;
+                pages = TRANSPARENT_HUGE_PAGES;
+            }
+        }
+#endif
+        if( addr == MAP_FAILED ){
+            addr = mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            if( addr == MAP_FAILED ){ cerr<<"IndexArena: out of memory"<<endl; exit(1); }
+#ifdef MADV_HUGEPAGE
+            if( pages == TRANSPARENT_HUGE_PAGES ) madvise(addr, size, MADV_HUGEPAGE);
+#endif
+        }
+        // the policy has to be set before the pages are touched for the first time
+        if( policy == INTERLEAVE_NODES ) interleave(addr, size);
+
+        chunks.push_back( pair<char*,size_t>((char*)addr, size) );
+        current = (char*)addr;
+        left    = size;
+    }
+
+public:
+    // bump allocation; nothing is returned to the arena until it is released as a whole
+    void* allocate(size_t bytes){
+        bytes = (bytes + 15) & ~size_t(15);
+        if( bytes > left ) newChunk( bytes > chunkSize ? bytes : chunkSize );
+        void *retval = current;
+        current += bytes;
+        left    -= bytes;
+        return retval;
+    }
+
+    // takes effect for the chunks mapped from now on
+    void configure(Pages p, Policy n){ pages = p; policy = n; }
+
+    size_t mapped(void) const {
+        size_t sum = 0;
+        for(auto &chunk : chunks) sum += chunk.second;
+        return sum;
+    }
+
+    void release(void){
+        for(auto &chunk : chunks) munmap(chunk.first, chunk.second);
+        chunks.clear();
+        current = 0;
+        left    = 0;
+    }
+
+    IndexArena(void):current(0),left(0),pages(TRANSPARENT_HUGE_PAGES),policy(LOCAL_NODE){}
+    ~IndexArena(void){ release(); }
+};
+
+// Standard allocator interface for the containers living in the arena
+template<class T> class IndexAllocator {
+public:
+    IndexArena *arena;
+
+    typedef T value_type;
+    typedef true_type propagate_on_container_copy_assignment;
+    typedef true_type propagate_on_container_move_assignment;
+    typedef true_type propagate_on_container_swap;
+    template<class U> struct rebind { typedef IndexAllocator<U> other; };
+
+    T*   allocate  (size_t n){ return (T*)arena->allocate(n*sizeof(T)); }
+    void deallocate(T*, size_t){}
+
+    IndexAllocator(IndexArena *a=0):arena(a){}
+    template<class U> IndexAllocator(const IndexAllocator<U> &src):arena(src.arena){}
+};
+template<class T, class U> bool operator==(const IndexAllocator<T> &a, const IndexAllocator<U> &b){ return a.arena == b.arena; }
+template<class T, class U> bool operator!=(const IndexAllocator<T> &a, const IndexAllocator<U> &b){ return a.arena != b.arena; }
+
+typedef basic_string< char, char_traits<char>, IndexAllocator<char> > Chromatid; // reference sequence
+typedef set< unsigned int, less<unsigned int>, IndexAllocator<unsigned int> > Positions; // k-mer locations
+// scoped adaptor hands the arena down to the nested sets of positions
+typedef map< unsigned long long, Positions, less<unsigned long long>,
+             scoped_allocator_adaptor< IndexAllocator< pair<const unsigned long long, Positions> > > > KmerIndex;
+
+// Counters and timers of the alignment hot path; every thread accumulates its own copy,
+//  which is added to the totals of the DNASequencing object when getAlignment returns
+struct AlignerStats {
+    unsigned long long pairs;              // read pairs processed
+    unsigned long long seedsProbed;        // k-mer look-ups in the index
+    unsigned long long seedsFound;         // ... that found the k-mer
+    unsigned long long hitsReturned;       // reference positions behind the found k-mers
+    unsigned long long maxHits;            // largest number of positions of a single k-mer (repeats)
+    unsigned long long candidatePairs;     // pairs of positions examined within the 700 bp window
+    unsigned long long alignFastCalls;
+    unsigned long long alignAccurateCalls;
+    unsigned long long dpCells;            // cells of the Needleman-Wunsch score matrices computed
+    unsigned long long cacheLookups;       // alreadySeen look-ups
+    unsigned long long cacheHits;          // ... that spared an alignment
+    double seeding;                        // time in the k-mer look-ups [s]
+    double alignFast;                      // time in the block-wise alignments around the seeds [s]
+    double alignAccurate;                  // time in the full alignments around the seeds [s]
+    double total;                          // time in getAlignment [s]
+
+    AlignerStats& operator+=(const AlignerStats &s){
+        pairs              += s.pairs;
+        seedsProbed        += s.seedsProbed;
+        seedsFound         += s.seedsFound;
+        hitsReturned       += s.hitsReturned;
+        if( maxHits < s.maxHits ) maxHits = s.maxHits;
+        candidatePairs     += s.candidatePairs;
+        alignFastCalls     += s.alignFastCalls;
+        alignAccurateCalls += s.alignAccurateCalls;
+        dpCells            += s.dpCells;
+        cacheLookups       += s.cacheLookups;
+        cacheHits          += s.cacheHits;
+        seeding            += s.seeding;
+        alignFast          += s.alignFast;
+        alignAccurate      += s.alignAccurate;
+        total              += s.total;
+        return *this;
+    }
+
+    AlignerStats(void){ bzero(this, sizeof(AlignerStats)); }
+};
+
 // Finally, implementation of the problem as required by the competition
 class DNASequencing {
 private:
-    string reference[25]; // not sure if 24 chromatids Ids start at 0 or 1, let's assume 1
-    map< unsigned long long, set<unsigned int> > lookUp[25]; // k-mer -> location (chromotid,positions)
+    IndexArena arena;        // has to outlive the containers below, hence declared first
+    Chromatid reference[25]; // not sure if 24 chromatids Ids start at 0 or 1, let's assume 1
+    KmerIndex lookUp[25];    // k-mer -> location (chromotid,positions)
     size_t step;   // k-mer step
 
     const static size_t len   = 150;
     const static size_t width = 30;
     int someCh;
 
+    bool fast;    // alignFast or alignAccurate around the seeds
+    bool verbose; // print every alignment as it is found
+
+    AlignerStats stats;      // totals over all threads and calls
+    mutex        statsMutex;
+
+    // counters of the calling thread
+    static AlignerStats& threadStats(void){
+        static thread_local AlignerStats local;
+        return local;
+    }
+
+    // dispatch to one of the two alignment methods and keep track of the time spent there
+    size_t align(size_t chId, size_t refPos, size_t readPos, const string &read, size_t &first, size_t &last, size_t &mismatches, size_t &indels);
+
 public:
     size_t alignFast    (size_t chId, size_t refPos, size_t readPos, const string &read, size_t &first, size_t &last, size_t &mismatches, size_t &indels, size_t maxMism, size_t maxIndels);
     size_t alignAccurate(size_t chId, size_t refPos, size_t readPos, const string &read, size_t &first, size_t &last);
@@ -259,6 +442,9 @@ public:
         return 0;
     }
 
+    // placement of the reference and the index in memory; call before passing the reference genome
+    void initMemory(IndexArena::Pages pages, IndexArena::Policy policy){ arena.configure(pages,policy); }
+
     int passReferenceGenome(int chromatidSequenceId, const vector<string> &chromatidSequence);
 
     void printRef(size_t chId, size_t first, size_t last){
@@ -267,9 +453,24 @@ public:
 
     int preProcessing(void);
 
+    void initAlignment(bool accurate, bool printout){ fast = !accurate; verbose = printout; }
+
+    AlignerStats statistics(void){
+        lock_guard<mutex> lock(statsMutex);
+        return stats;
+    }
+
+    // dump the hot path counters in JSON format
+    void dumpStats(ostream &out);
+
     vector<string> getAlignment(size_t N, double normA, double normS, const vector<string> &readName, const vector<string> &readSequence);
 
-    DNASequencing(void){}
+    DNASequencing(void):fast(true),verbose(true){
+        for(size_t chId=0; chId<25; chId++){
+            reference[chId] = Chromatid( IndexAllocator<char>(&arena) );
+            lookUp   [chId] = KmerIndex( KmerIndex::allocator_type( IndexAllocator<char>(&arena) ) );
+        }
+    }
     ~DNASequencing(void){}
 };
 
@@ -279,8 +480,13 @@ int DNASequencing::passReferenceGenome(int chromatidSequenceId, const vector<str
     someCh = chromatidSequenceId; // when failed to align a read, report back any of the chromatid seen in this function
     reference[ chromatidSequenceId ].clear();
     if( chromatidSequenceId < 0 || chromatidSequenceId > 24 ) return -1;
+    // nothing is ever freed in the arena, so avoid leaving a trail of reallocations behind
+    size_t length = 0;
+    for( auto &line : chromatidSequence ) length += line.length();
+    reference[ chromatidSequenceId ].reserve( length );
     for( auto &line : chromatidSequence )
-        reference[ chromatidSequenceId ].append( line.substr(0,line.length()-1) ); // Fucking Windows eol extra symbol!
+        if( line.length() )
+            reference[ chromatidSequenceId ].append( line.c_str(), line.length() - (line[line.length()-1]=='\r') ); // Fucking Windows eol extra symbol!
     return 0;
 }
 
@@ -299,6 +505,7 @@ int DNASequencing::preProcessing(void){
         }
         cout<<"chId="<<chId<<" done"<<endl;
     }
+    cout<<"Reference and index occupy "<<(arena.mapped()>>20)<<" MB"<<endl;
     return 0;
 }
 
@@ -316,6 +523,7 @@ const char complement[128] = {
 
 size_t DNASequencing::alignFast(size_t chId, size_t refPos, size_t readPos, const string &read, size_t &first, size_t &last, size_t &mismatches, size_t &indels, size_t maxMism, size_t maxIndels){
     const char *ref = reference[chId].c_str();
+    AlignerStats &local = threadStats();
 
     size_t s = 0;
     int    shift = 0;
@@ -366,6 +574,7 @@ size_t DNASequencing::alignFast(size_t chId, size_t refPos, size_t readPos, cons
 
             static size_t score[width+1][width+1];
             s += alignmentScoreMatrix( rf.c_str(), rd.c_str(), (size_t**)score );
+            local.dpCells += width*width;
 
             static char a[2*width], b[2*width];
             size_t newlen = reconstruction(rf.c_str(), rd.c_str(), (const size_t **)score, a, b);
@@ -413,6 +622,7 @@ size_t DNASequencing::alignFast(size_t chId, size_t refPos, size_t readPos, cons
 
             static size_t score[width+1][width+1];
             s += alignmentScoreMatrix( rf.c_str(), rd.c_str(), (size_t**)score );
+            local.dpCells += width*width;
 
             static char a[2*width], b[2*width];
             size_t newlen = reconstruction(rf.c_str(), rd.c_str(), (const size_t **)score, a, b);
@@ -436,6 +646,22 @@ size_t DNASequencing::alignFast(size_t chId, size_t refPos, size_t readPos, cons
     return s;
 }
 
+size_t DNASequencing::align(size_t chId, size_t refPos, size_t readPos, const string &read, size_t &first, size_t &last, size_t &mismatches, size_t &indels){
+    AlignerStats &local = threadStats();
+    chrono::steady_clock::time_point starts = chrono::steady_clock::now();
+    size_t score = 0;
+    if( fast ){
+        score = alignFast(chId, refPos, readPos, read, first, last, mismatches, indels, 10,5);
+        local.alignFast     += chrono::duration<double>(chrono::steady_clock::now() - starts).count();
+        local.alignFastCalls++;
+    } else {
+        score = alignAccurate(chId, refPos, readPos, read, first, last);
+        local.alignAccurate += chrono::duration<double>(chrono::steady_clock::now() - starts).count();
+        local.alignAccurateCalls++;
+    }
+    return score;
+}
+
 double DNASequencing::probability(size_t &mismatches, size_t &indels){
     double prob = 0;
 // work for a fixed read length of len=150 only:
@@ -490,11 +716,12 @@ size_t DNASequencing::alignAccurate(size_t chId, size_t refPos, size_t readPos,
     if( start  + length > reference[chId].length() )
         length = reference[chId].length() - start;
 
-    string ref = reference[chId].substr( start, length );
+    string ref( reference[chId].c_str() + start, length );
     string pad = string( (readPos*misCost)/gapCost, '+' ). append(read). append( ((len-readPos-width)*misCost)/gapCost, '+' );
 
     size_t score[pad.length()+1][ref.length()+1];
     size_t s = alignmentScoreMatrix(pad.c_str(), ref.c_str(), (size_t**)score);
+    threadStats().dpCells += pad.length() * ref.length();
 
     static char a[2*len], b[2*len];
     reconstruction(pad.c_str(), ref.c_str(), (const size_t **)score, a, b);
@@ -526,12 +753,16 @@ size_t DNASequencing::alignAccurate(size_t chId, size_t refPos, size_t readPos,
 vector<string> DNASequencing::getAlignment(size_t N, double normA, double normS, const vector<string> &readName, const vector<string> &readSequence){
     vector<string> retval;
 
-    cout<<"calling getAlignment"<<endl;
+    if(verbose) cout<<"calling getAlignment"<<endl;
+
+    bool debug = false;
 
-    bool debug = false, fast = true;
+    AlignerStats &local = threadStats();
+    chrono::steady_clock::time_point starts = chrono::steady_clock::now();
 
     for(size_t read=0; read<N/2; read++){
         // all reads are paired, always consider them together 
+        local.pairs++;
 
         size_t read1 = 2*read;
         size_t read2 = 2*read + 1;
@@ -585,18 +816,38 @@ for(unsigned short shift=0; shift<step && pos+shift+width<len; shift++){
             unsigned long long viewR1 = numR1.view(pos,width);
             unsigned long long viewR2 = numR2.view(pos+shift,width);
 
-            // try to match every chromatid
+            // look the k-mers up in all chromatids first: the clock is read once per position
+            KmerIndex::const_iterator hitsF1[25], hitsF2[25], hitsR1[25], hitsR2[25];
+            chrono::steady_clock::time_point seedingStarts = chrono::steady_clock::now();
             for(size_t chId=0; chId<25; chId++){
 
                 if( lookUp[chId].size() == 0 ) continue;
 
                 // look for a match with forward direction hypothesis
-                map< unsigned long long, set<unsigned int> >::const_iterator hitF1 = lookUp[chId].find(viewF1);
-                map< unsigned long long, set<unsigned int> >::const_iterator hitF2 = lookUp[chId].find(viewF2);
+                hitsF1[chId] = lookUp[chId].find(viewF1);
+                hitsF2[chId] = lookUp[chId].find(viewF2);
 
                 // look for a match with reverse direction hypothesis
-                map< unsigned long long, set<unsigned int> >::const_iterator hitR1 = lookUp[chId].find(viewR1);
-                map< unsigned long long, set<unsigned int> >::const_iterator hitR2 = lookUp[chId].find(viewR2);
+                hitsR1[chId] = lookUp[chId].find(viewR1);
+                hitsR2[chId] = lookUp[chId].find(viewR2);
+            }
+            local.seeding += chrono::duration<double>(chrono::steady_clock::now() - seedingStarts).count();
+
+            // try to match every chromatid
+            for(size_t chId=0; chId<25; chId++){
+
+                if( lookUp[chId].size() == 0 ) continue;
+
+                const KmerIndex::const_iterator &hitF1 = hitsF1[chId], &hitF2 = hitsF2[chId];
+                const KmerIndex::const_iterator &hitR1 = hitsR1[chId], &hitR2 = hitsR2[chId];
+
+                local.seedsProbed += 4;
+                for(const KmerIndex::const_iterator &hit : {hitF1, hitF2, hitR1, hitR2})
+                    if( hit != lookUp[chId].end() ){
+                        local.seedsFound++;
+                        local.hitsReturned += hit->second.size();
+                        if( local.maxHits < hit->second.size() ) local.maxHits = hit->second.size();
+                    }
 
 if(debug) cout<<"pos = "<<pos<<" viewF1 = "<<hex<<viewF1<<" viewF2 = "<<viewF2<<" viewR1 = "<<viewR1<<" viewR2 = "<<viewR2<<dec<<endl;
 
@@ -606,8 +857,8 @@ if(debug) cout<<"pos = "<<pos<<" viewF1 = "<<hex<<viewF1<<" viewF2 = "<<viewF2<<
 
                     // found set(!) of hits that belong to the same chromatid, now check if their positions are far apart
                     bool  firstIsSmall = hitF1->second.size() <= hitF2->second.size() ;
-                    const set<unsigned int> &smallerList      = (  firstIsSmall ? hitF1->second : hitF2->second );
-                    const set<unsigned int> &biggerList       = ( !firstIsSmall ? hitF1->second : hitF2->second );
+                    const Positions &smallerList      = (  firstIsSmall ? hitF1->second : hitF2->second );
+                    const Positions &biggerList       = ( !firstIsSmall ? hitF1->second : hitF2->second );
                     const string &seqSmall                    = (  firstIsSmall ? readSequence[read1]: reverseCompliment2);
                     const string &seqBig                      = ( !firstIsSmall ? readSequence[read1]: reverseCompliment2);
                     map< unsigned int, pair<unsigned int,pair<size_t,double> > > &seenSmall = ( firstIsSmall ? alreadySeenF1[chId] : alreadySeenF2[chId]);
@@ -621,11 +872,13 @@ if(debug) cout<<" same chromo1: "<<chId<<", sizeF1: "<<hitF1->second.size()<<" s
 if(debug) cout << "  refPos1:" << refPos << endl;
 
                         // consider all paired alignments close by within 700 base pairs
-                        set<unsigned int>::const_iterator complement = biggerList.upper_bound(int(refPos)-int(700));
+                        Positions::const_iterator complement = biggerList.upper_bound(int(refPos)-int(700));
                         while( complement != biggerList.end() && int(*complement)-int(refPos) < 700 ){
 
 if(debug) cout << "   complement1:" << *complement << endl;
 
+                            local.candidatePairs++;
+
                             size_t score1, score2;
                             size_t first1, last1;
                             size_t first2, last2;
@@ -633,19 +886,18 @@ if(debug) cout << "   complement1:" << *complement << endl;
 
                             // check if the beggining of the k-mer is a predecessor for end of some alignment
                             map< unsigned int, pair<unsigned int,pair<size_t,double> > >::const_iterator candidate = seenSmall.lower_bound(refPos);
+                            local.cacheLookups++;
                             //  ... and beginning of this alignment is a predecessor of this k-mer (i.e. the k-mer is in alignment we've already seen)
                             if( candidate == seenSmall.end() || candidate->second.first > refPos ){
                                 size_t mismatches=0, indels=0;
-                                if( fast )
-                                    score1 = alignFast(chId, refPos, pos + (firstIsSmall?0:shift), seqSmall, first1, last1, mismatches, indels, 10,5);
-                                else
-                                    score1 = alignAccurate(chId, refPos, pos + (firstIsSmall?0:shift), seqSmall, first1, last1);
+                                score1 = align(chId, refPos, pos + (firstIsSmall?0:shift), seqSmall, first1, last1, mismatches, indels);
 
                                 prob1 = ( score1<10000 ? probability(mismatches, indels) : 0);
 
                                 seenSmall[last1] = pair< unsigned int, pair<size_t,double> >( first1, pair<size_t,double>(score1,prob1) );
 if(debug) cout<<"   alignment1 score1:"<<score1<<" probability: "<<prob1<<endl;
                             } else {
+                                local.cacheHits++;
                                 prob1  = candidate->second.second.second;
                                 score1 = candidate->second.second.first;
                                 first1 = candidate->second.first;
@@ -653,18 +905,17 @@ if(debug) cout<<"   alignment1 score1:"<<score1<<" probability: "<<prob1<<endl;
                             }
                             // same for the second read in the pair
                             map< unsigned int, pair<unsigned int,pair<size_t,double> > >::const_iterator candidate2 = seenBig.lower_bound(*complement);
+                            local.cacheLookups++;
                             if( candidate2 == seenBig.end() || candidate2->second.first > *complement ){
                                 size_t mismatches=0, indels=0;
-                                if( fast )
-                                    score2 = alignFast(chId, *complement, pos + (!firstIsSmall?0:shift), seqBig, first2, last2, mismatches, indels, 10,5);
-                                else
-                                    score2 = alignAccurate(chId, *complement, pos + (!firstIsSmall?0:shift), seqBig, first2, last2);
+                                score2 = align(chId, *complement, pos + (!firstIsSmall?0:shift), seqBig, first2, last2, mismatches, indels);
 
                                 prob2 = ( score2<10000 ? probability(mismatches, indels) : 0);
 
                                 seenBig[last2] = pair< unsigned int, pair<size_t,double> >( first2, pair<size_t,double>(score2,prob2) );
 if(debug) cout<<"   alignment1 score2:"<<score2<<" probability: "<<prob2<<endl;
                             } else {
+                                local.cacheHits++;
                                 prob2  = candidate2->second.second.second;
                                 score2 = candidate2->second.second.first;
                                 first2 = candidate2->second.first;
@@ -713,8 +964,8 @@ if(debug) cout<<"   found best1: bestScore1="<<score1<<" bestScore2="<<score2<<"
 
                     // found set(!) of hits belong to the same chromatid, now check if their positions are far apart
                     bool firstIsSmall = hitR1->second.size() <= hitR2->second.size() ;
-                    const set<unsigned int> &biggerList       = ( !firstIsSmall ? hitR1->second : hitR2->second );
-                    const set<unsigned int> &smallerList      = (  firstIsSmall ? hitR1->second : hitR2->second );
+                    const Positions &biggerList       = ( !firstIsSmall ? hitR1->second : hitR2->second );
+                    const Positions &smallerList      = (  firstIsSmall ? hitR1->second : hitR2->second );
                     const string &seqBig                      = ( !firstIsSmall ? reverseCompliment1: readSequence[read2]);
                     const string &seqSmall                    = (  firstIsSmall ? reverseCompliment1: readSequence[read2]);
                     map< unsigned int, pair<unsigned int,pair<size_t,double> > > &seenBig   = (!firstIsSmall ? alreadySeenR1[chId] : alreadySeenR2[chId]);
@@ -727,11 +978,13 @@ if(debug) cout<<" same chromo2: "<< chId << " sizeR1: "<<hitR1->second.size()<<"
 if(debug) cout << "  refPos2:" << refPos << endl;
 
                         // consider all paired alignments close by within 700 base pairs
-                        set<unsigned int>::const_iterator complement = biggerList.upper_bound(int(refPos)-int(700));
+                        Positions::const_iterator complement = biggerList.upper_bound(int(refPos)-int(700));
                         while( complement != biggerList.end() && int(*complement)-int(refPos) < 700 ){
 
 if(debug) cout << "   complement2:" << *complement << endl;
 
+                            local.candidatePairs++;
+
                             size_t score1, score2;
                             size_t first1, last1;
                             size_t first2, last2;
@@ -739,19 +992,18 @@ if(debug) cout << "   complement2:" << *complement << endl;
 
                             // check if the beggining of the k-mer is a predecessor for end of some alignment
                             map< unsigned int, pair<unsigned int,pair<size_t,double> > >::const_iterator candidate = seenSmall.lower_bound(refPos);
+                            local.cacheLookups++;
                             //  ... and beginning of this alignment is a predecessor of this k-mer (i.e. the k-mer is in alignment we've already seen)
                             if( candidate == seenSmall.end() || candidate->second.first > refPos ){
                                 size_t mismatches=0, indels=0;
-                                if( fast )
-                                    score1 = alignFast(chId, refPos, pos + (firstIsSmall?0:shift), seqSmall, first1, last1, mismatches, indels, 10,5);
-                                else
-                                    score1 = alignAccurate(chId, refPos, pos + (firstIsSmall?0:shift), seqSmall, first1, last1);
+                                score1 = align(chId, refPos, pos + (firstIsSmall?0:shift), seqSmall, first1, last1, mismatches, indels);
 
                                 prob1 = ( score1<10000 ? probability(mismatches, indels) : 0);
 
                                 seenSmall[last1] = pair< unsigned int, pair<size_t,double> >( first1, pair<size_t,double>(score1,prob1) );
 if(debug) cout<<"   alignment2 score1:"<<score1<<" probability: "<<prob1<<endl;
                             } else {
+                                local.cacheHits++;
                                 prob1  = candidate->second.second.second;
                                 score1 = candidate->second.second.first;
                                 first1 = candidate->second.first;
@@ -759,18 +1011,17 @@ if(debug) cout<<"   alignment2 score1:"<<score1<<" probability: "<<prob1<<endl;
                             }
                             // same for the second read in the pair
                             map< unsigned int, pair<unsigned int,pair<size_t,double> > >::const_iterator candidate2 = seenBig.lower_bound(*complement);
+                            local.cacheLookups++;
                             if( candidate2 == seenBig.end() || candidate2->second.first > *complement ){
                                 size_t mismatches=0, indels=0;
-                                if( fast )
-                                    score2 = alignFast(chId, *complement, pos + (!firstIsSmall?0:shift), seqBig, first2, last2, mismatches, indels, 10,5);
-                                else
-                                    score2 = alignAccurate(chId, *complement, pos + (!firstIsSmall?0:shift), seqBig, first2, last2);
+                                score2 = align(chId, *complement, pos + (!firstIsSmall?0:shift), seqBig, first2, last2, mismatches, indels);
 
                                 prob2 = ( score2<10000 ? probability(mismatches, indels) : 0);
 
                                 seenBig[last2] = pair< unsigned int, pair<size_t,double> >( first2, pair<size_t,double>(score2,prob2) );
 if(debug) cout<<"   alignment2 score2:"<<score2<<" probability: "<<prob2<<endl;
                             } else {
+                                local.cacheHits++;
                                 prob2  = candidate2->second.second.second;
                                 score2 = candidate2->second.second.first;
                                 first2 = candidate2->second.first;
@@ -837,8 +1088,7 @@ if(debug) cout<<"   final best: bestScore1="<<bestScore1<<" bestScore2="<<bestSc
                         bestProb1
             );
             retval.push_back( buffer );
-//if(debug) 
-cout<<buffer<<endl;
+            if(verbose) cout<<buffer<<endl;
 
             sprintf(buffer,"%s,%d,%lld,%lld,%c,%f",
                         readName[read2].c_str(),
@@ -849,23 +1099,53 @@ cout<<buffer<<endl;
                         bestProb2
             );
             retval.push_back( buffer );
-//if(debug) 
-cout<<buffer<<endl;
+            if(verbose) cout<<buffer<<endl;
 
         } else {
             sprintf(buffer,"%s,%d,%d,%d,%c,%f",readName[read1].c_str(),someCh,1,2,'+',0.);
             retval.push_back( buffer );
-//if(debug) 
-cout<<buffer<<" seq=NULL"<<endl;
+            if(verbose) cout<<buffer<<" seq=NULL"<<endl;
             sprintf(buffer,"%s,%d,%d,%d,%c,%f",readName[read2].c_str(),someCh,1,2,'-',0.);
             retval.push_back( buffer );
-//if(debug) 
-cout<<buffer<<" seq=NULL"<<endl;
+            if(verbose) cout<<buffer<<" seq=NULL"<<endl;
         }
 
 
     }
+
+    // hand over the counters of this thread
+    local.total += chrono::duration<double>(chrono::steady_clock::now() - starts).count();
+    statsMutex.lock();
+    stats += local;
+    statsMutex.unlock();
+    local = AlignerStats();
+
     return retval;
+}
 
+void DNASequencing::dumpStats(ostream &out){
+    AlignerStats s = statistics();
+    out<<"{"<<endl;
+    out<<"  \"step\": "              <<step                <<","<<endl;
+    out<<"  \"width\": "             <<width               <<","<<endl;
+    out<<"  \"pairs\": "             <<s.pairs             <<","<<endl;
+    out<<"  \"seedsProbed\": "       <<s.seedsProbed       <<","<<endl;
+    out<<"  \"seedsFound\": "        <<s.seedsFound        <<","<<endl;
+    out<<"  \"hitsReturned\": "      <<s.hitsReturned      <<","<<endl;
+    out<<"  \"maxHits\": "           <<s.maxHits           <<","<<endl;
+    out<<"  \"candidatePairs\": "    <<s.candidatePairs    <<","<<endl;
+    out<<"  \"alignFastCalls\": "    <<s.alignFastCalls    <<","<<endl;
+    out<<"  \"alignAccurateCalls\": "<<s.alignAccurateCalls<<","<<endl;
+    out<<"  \"dpCells\": "           <<s.dpCells           <<","<<endl;
+    out<<"  \"cacheLookups\": "      <<s.cacheLookups      <<","<<endl;
+    out<<"  \"cacheHits\": "         <<s.cacheHits         <<","<<endl;
+    out<<"  \"cacheHitRate\": "      <<(s.cacheLookups ? double(s.cacheHits)/s.cacheLookups : 0.)<<","<<endl;
+    out<<"  \"time\": {"<<endl;
+    out<<"    \"seeding\": "         <<s.seeding           <<","<<endl;
+    out<<"    \"alignFast\": "       <<s.alignFast         <<","<<endl;
+    out<<"    \"alignAccurate\": "   <<s.alignAccurate     <<","<<endl;
+    out<<"    \"total\": "           <<s.total             <<endl;
+    out<<"  }"<<endl;
+    out<<"}"<<endl;
 }
 
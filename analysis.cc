@@ -7,19 +7,23 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <getopt.h>
 
 #include "toolbox.h"
+#include "fastq.h"
+#include "kmercounter.h"
 
 const char *fileName = "./testReads.fastq";
 
-#define NREC (10000)
+// Counting without the comprehensive statistics runs on 'nThreads' threads: the k-mers go to
+//  4^partitionSymbols partitions, optionally spilled to temporary files in 'spillDir'
+size_t nThreads = 1;
+size_t partitionSymbols = 3;
+const char *spillDir = 0;
 
 using namespace std;
-vector<string> identifier(NREC);
-vector<string> sequence  (NREC);
-vector<string> quality   (NREC);
+FastqFile fastq;
 map<size_t,size_t> errors; // record number and position of the unrecognized symbol
-map<unsigned long long,unsigned int>  counts;         // pattern occupancy
 map<unsigned long long,list<size_t> > pattern2record; // list of record numbers where the pattern is found
 map<unsigned long long,list<double> > averageQuality; // 
 map<unsigned long long,list<double> > averageAcuracy; // 
@@ -73,37 +77,68 @@ double accuracy(const char *qual, size_t length){
     return retval;
 }
 
-int main(int argc, char *argv[]){
-    if( argc < 2 ) return 0;
-
-    // open input file
-    ifstream input(fileName);
-    if(!input){ cout<<"Cannot open "<<fileName<<endl; return 0; }
-
-    // read the records
-    size_t nReads=0;
-    while( !input.eof() ){
+// hand every view of the read over to 'count' (its position and the packed view) skipping the views
+//  with unknown symbols; returns the position of the first unknown symbol (from 1) or 0
+template<class Count> size_t countViews(size_t read, size_t viewWidth, Count count){
+    const char *seq = fastq.sequence(read).c_str();
+    size_t length   = fastq.sequence(read).length();
+    NumericSequence numSeq(seq);
+
+    for(size_t i=0; i<length-viewWidth; i++){
+        // if there was an unknown symbol in the sequence, discard every view that includes it 
+        if( numSeq.error() - i < viewWidth ) continue;
+        count(i, numSeq.view(i,viewWidth));
+    }
+    return numSeq.error();
+}
 
-        if( nReads == identifier.size() ){
-            identifier.resize( identifier.size() + NREC );
-            sequence.  resize( sequence.  size() + NREC );
-            quality.   resize( quality.   size() + NREC );
-        }
+#define READS_PER_TASK (1<<14)
 
-        string tmp;
-        getline(input, identifier[nReads], '\n' ); 
-        getline(input, sequence  [nReads], '\n' );
-        getline(input, tmp,                '\n' );
-        getline(input, quality   [nReads], '\n' );
+int main(int argc, char *argv[]){
 
-        if( identifier[nReads][0] != '@' || tmp[0] != '+') break;
-        nReads++;
+    // parse the options, the positional arguments follow: length of the patterns,
+    //  any second argument for the comprehensive statistics, the pattern to store qualities of
+    static struct option options[] = {
+       {"help",         0, 0, 'h'},
+       {"cores",        1, 0, 'c'},
+       {"partitions",   1, 0, 'p'},
+       {"spill",        1, 0, 's'},
+       {0, 0, 0, 0}
+    };
+
+    while( 1 ){
+       int index=0;
+       int c = getopt_long(argc, argv, "hc:p:s:",options, &index);
+       if( c == -1 ) break;
+       switch( c ) {
+           case 'h':
+               cout<<"Usage: analysis [options] length [comprehensive [pattern]]"<<endl;
+               cout<<"-h     ,   --help              show this message"<<endl;
+               cout<<"-c     ,   --cores             Number of CPU cores counting the patterns (not comprehensive) [default=1]"<<endl;
+               cout<<"-p     ,   --partitions        Partition the patterns by so many last symbols [default=3]"<<endl;
+               cout<<"-s     ,   --spill             Directory to keep the partitions in until counted"<<endl;
+               return 0;
+           break;
+           case 'c':
+               nThreads = strtoul(optarg,NULL,0);
+           break;
+           case 'p':
+               partitionSymbols = strtoul(optarg,NULL,0);
+           break;
+           case 's':
+               spillDir = optarg;
+           break;
+           default : cout<<"Type -h for help"<<endl; return 0;
+       }
     }
-    input.close();
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if( argc < 2 || nThreads < 1 ) return 0;
 
-    identifier.resize(nReads);
-    sequence.  resize(nReads);
-    quality.   resize(nReads);
+    // map the input file and index the records
+    if( fastq.open(fileName, nThreads) ) return 0;
+    size_t nReads = fastq.size();
 
     cout<<"Reads: "<<nReads<<endl;
 
@@ -111,51 +146,80 @@ int main(int argc, char *argv[]){
     const unsigned int viewWidth = atoi(argv[1]);
     bool comprehensive = (argc>2 ? true : false);
 
-    // run a density check
-    for(size_t read=0; read<nReads; read++){
-        const char *seq = sequence[read].c_str();
-        NumericSequence numSeq(seq);
-
-        if( numSeq.error() )
-            errors[read] = numSeq.error();
-
-        for(size_t i=0; i<strlen(seq)-viewWidth; i++){
-            // if there was an unknown symbol in the sequence, discard every view that includes it 
-            if( numSeq.error() - i < viewWidth ) continue;
-
-            unsigned long long view = numSeq.view(i,viewWidth);
-            counts[view]++;
-            if( comprehensive ){
-                pattern2record[view].push_back(i);
-                averageQuality[view].push_back( adjustedMean(quality[read].c_str()+i,viewWidth) );
-                averageAcuracy[view].push_back( accuracy    (quality[read].c_str()+i,viewWidth) );
-            }
-        }
-    }
-
-    cout<<"Found unique sequences of length "<<viewWidth<<": "<<counts.size()<<endl;
-
     ofstream output("output.csv");
 
     if( !output ){ cout<<"Cannot open "<<"output.csv"<<endl; return 0; }
 
     output<<"ID,label,count"<<(comprehensive?",meanQual,sdQual,accuracy":"")<<endl;
 
-    for(map<unsigned long long,unsigned int>::const_iterator seq = counts.begin(); seq != counts.end(); seq++){
-        output<<seq->first<<","<<number2sequence(seq->first,viewWidth)<<","<<seq->second;
+    size_t nUnique = 0;
+    auto write = [&](const KmerCounter::Entry &seq){
+        output<<seq.first<<","<<number2sequence(seq.first,viewWidth)<<","<<seq.second;
         if( comprehensive ){
-            list<double> &q = averageQuality[seq->first];
+            list<double> &q = averageQuality[seq.first];
             double meanQual = mean(q);
             double sdQual   = sqrt(variance(q) - meanQual*meanQual);
-            list<double> &a = averageAcuracy[seq->first];
+            list<double> &a = averageAcuracy[seq.first];
             double meanAcc  = mean(a);
             output<<","<<meanQual<<","<<sdQual<<","<<meanAcc<<endl;
         } else {
             output<<endl;
         }
+        nUnique++;
+    };
+
+    if( comprehensive ){
+        // pattern occupancy
+        KmerCounter counts(viewWidth);
+
+        // run a density check
+        for(size_t read=0; read<nReads; read++){
+            size_t error = countViews(read, viewWidth, [&](size_t i, unsigned long long view){
+                counts.add(view);
+                pattern2record[view].push_back(i);
+                averageQuality[view].push_back( adjustedMean(fastq.quality(read).c_str()+i,viewWidth) );
+                averageAcuracy[view].push_back( accuracy    (fastq.quality(read).c_str()+i,viewWidth) );
+            } );
+            if( error )
+                errors[read] = error;
+        }
+
+        vector<KmerCounter::Entry> entries;
+        counts.sorted(entries);
+        for(size_t e=0; e<entries.size(); e++) write(entries[e]);
+
+    } else {
+        // pattern occupancy gathered by all threads
+        PartitionedKmerCounter counts(viewWidth, partitionSymbols);
+        if( spillDir && !counts.spill(spillDir) ){ cout<<"Cannot spill to "<<spillDir<<endl; return 0; }
+
+        // run a density check on ranges of reads in parallel
+        ThreadPool pool(nThreads);
+        const size_t nRanges = (nReads + READS_PER_TASK - 1) / READS_PER_TASK;
+        vector< vector< pair<size_t,size_t> > > rangeErrors(nRanges);
+        for(size_t r=0; r<nRanges; r++)
+            pool.submit( [&,r]{
+                PartitionedKmerCounter::Buffer buffer;
+                size_t end = min(nReads, (r+1)*READS_PER_TASK);
+                for(size_t read=r*READS_PER_TASK; read<end; read++){
+                    size_t error = countViews(read, viewWidth, [&](size_t, unsigned long long view){ counts.add(buffer, view); } );
+                    if( error )
+                        rangeErrors[r].push_back( make_pair(read, error) );
+                }
+                counts.flush(buffer);
+            } );
+        pool.wait();
+
+        for(size_t r=0; r<nRanges; r++) errors.insert( rangeErrors[r].begin(), rangeErrors[r].end() );
+
+        counts.dump(pool, [&](const vector<KmerCounter::Entry> &entries){
+            for(size_t e=0; e<entries.size(); e++) write(entries[e]);
+        } );
     }
     output.close();
 
+    cout<<"Found unique sequences of length "<<viewWidth<<": "<<nUnique<<endl;
+
     // summarize the errors
     cout<<"Found "<<errors.size()<<" errors"<<endl;
 
@@ -163,10 +227,10 @@ int main(int argc, char *argv[]){
     err<<"id,rank,x,y,len,rec,symb,qual"<<endl;
     for(map<size_t,size_t>::const_iterator e=errors.begin(); e!=errors.end(); e++){
         char id[128], rank[128], x[128], y[128], len[128];
-        sscanf( identifier[e->first].c_str(), "@%s rank=%s x=%s y=%s length=%s",id,rank,x,y,len);
+        sscanf( fastq.identifier(e->first).c_str(), "@%s rank=%s x=%s y=%s length=%s",id,rank,x,y,len);
         err<<id<<","<<rank<<","<<x<<","<<y<<","<<len<<","
-           <<e->first<<","<<sequence[e->first][e->second-1]<<","
-           <<int(quality [e->first][e->second-1]-phredMinScore)
+           <<e->first<<","<<fastq.sequence(e->first)[e->second-1]<<","
+           <<int(fastq.quality (e->first)[e->second-1]-phredMinScore)
            <<endl;
     }
     err.close();
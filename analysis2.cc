@@ -9,15 +9,12 @@
 #include <map>
 
 #include "toolbox.h"
-
-#define NREC (10000)
+#include "fastq.h"
+#include "kmercounter.h"
 
 using namespace std;
-vector<string> identifier(NREC);
-vector<string> sequence  (NREC);
-vector<string> quality   (NREC);
+FastqFile fastq;
 map<size_t,size_t> errors; // record number and position of the unrecognized symbol
-map<unsigned long long,unsigned int>  counts;         // pattern occupancy
 
 int main(int argc, char *argv[]){
     if( argc < 2 ) return 0;
@@ -31,40 +28,18 @@ int main(int argc, char *argv[]){
         viewWidth    = strtol(argv[3],NULL,0);
     }
 
-    // open input file
-    ifstream input(fileName);
-    if(!input){ cout<<"Cannot open "<<fileName<<endl; return 0; }
-
-    // read the records
-    size_t nReads=0;
-    while( !input.eof() ){
-
-        if( nReads == identifier.size() ){
-            identifier.resize( identifier.size() + NREC );
-            sequence.  resize( sequence.  size() + NREC );
-            quality.   resize( quality.   size() + NREC );
-        }
-
-        string tmp;
-        getline(input, identifier[nReads], '\n' ); 
-        getline(input, sequence  [nReads], '\n' );
-        getline(input, tmp,                '\n' );
-        getline(input, quality   [nReads], '\n' );
-
-        if( identifier[nReads][0] != '@' || tmp[0] != '+') break;
-        nReads++;
-    }
-    input.close();
+    // pattern occupancy
+    KmerCounter counts(viewWidth);
 
-    identifier.resize(nReads);
-    sequence.  resize(nReads);
-    quality.   resize(nReads);
+    // map the input file and index the records
+    if( fastq.open(fileName) ) return 0;
+    size_t nReads = fastq.size();
 
     cout<<"Reads: "<<nReads<<endl;
 
     // run a density check
     for(size_t read=0; read<nReads; read++){
-        const char *seq = sequence[read].c_str();
+        const char *seq = fastq.sequence(read).c_str();
         NumericSequence numSeq(seq);
 
         if( numSeq.error() )
@@ -76,7 +51,7 @@ int main(int argc, char *argv[]){
             if( numSeq.error() - i < viewWidth ) continue;
 
             unsigned long long view = numSeq.view(i,viewWidth);
-            counts[view]++;
+            counts.add(view);
         }
     }
 
@@ -88,7 +63,9 @@ int main(int argc, char *argv[]){
 
     output<<"ID,label,count"<<endl;
 
-    for(map<unsigned long long,unsigned int>::const_iterator seq = counts.begin(); seq != counts.end(); seq++)
+    vector<KmerCounter::Entry> entries;
+    counts.sorted(entries);
+    for(vector<KmerCounter::Entry>::const_iterator seq = entries.begin(); seq != entries.end(); seq++)
         output<<seq->first<<","<<number2sequence(seq->first,viewWidth)<<","<<seq->second<<endl;
     output.close();
 
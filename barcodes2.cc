@@ -9,129 +9,149 @@
 #include <set>
 #include <map>
 #include <list>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
 
 #include <thread>
-#include <future>
-#include <chrono>
 
 #include <getopt.h>
 
 #include "./toolbox.h"
+#include "./unionfind.h"
+#include "./fastq.h"
+#include "./threadpool.h"
 
 using namespace std;
 // Compile with:
-// g++ -Wl,--no-as-needed -g -Wall -std=c++11 -o barcodes2 barcodes2.cc -lpthread
+// g++ -Wl,--no-as-needed -g -Wall -std=c++11 -o barcodes2 barcodes2.cc -lpthread -lz
 
 ////////////////////// routine for reading fastq //////////////////////
 
 // keep reads from the input file in global environment
 size_t nReads = 0;
-#define NREC (10000)
-vector<string> identifier(NREC);
-vector<string> sequence  (NREC);
-vector<string> quality   (NREC);
+FastqFile fastq;
 
-int readFile(const char *fileName){
-
-    ifstream input(fileName);
-
-    if(!input){ cerr<<"Cannot open "<<fileName<<endl; return -1; }
-
-    while( !input.eof() ){
-
-        if( nReads == identifier.size() ){
-            identifier.resize( identifier.size() + NREC );
-            sequence.  resize( sequence.  size() + NREC );
-            quality.   resize( quality.   size() + NREC );
-        }
+int readFile(const char *fileName, size_t nThreads){
+    if( fastq.open(fileName, nThreads) ) return -1;
+    nReads = fastq.size();
+    return 0;
+}
 
-        string tmp;
-        getline(input, identifier[nReads], '\n' );
-        getline(input, sequence  [nReads], '\n' );
-        getline(input, tmp,                '\n' );
-        getline(input, quality   [nReads], '\n' );
+// the streaming mode keeps only the packed beginnings of the reads and reads the file again for the output
+bool streaming = false;
 
-        if( identifier[nReads][0] != '@' || tmp[0] != '+') break;
-        nReads++;
+// 2 bits per symbol of the first 'barcodeWidth' symbols and a bit per non-interpretable symbol,
+//  computed once per read while loading; the patterns are then cut out of it with shifts
+struct Prefix {
+    unsigned long long code;
+    unsigned int       bad; // all set for reads shorter than 'barcodeWidth'
+};
+vector<Prefix> prefixes;
+
+Prefix packPrefix(const char *seq, size_t length, size_t width){
+    Prefix prefix = {0, ~0U};
+    if( length < width ) return prefix;
+    prefix.bad = 0;
+    for(size_t pos=0; pos<width; pos++){
+        unsigned short errorPos = 0;
+        prefix.code |= sequence2number(seq+pos, 1, errorPos) << (2*pos);
+        if( errorPos ) prefix.bad |= 1U<<pos;
     }
-    input.close();
+    return prefix;
+}
 
-    identifier.resize(nReads);
-    sequence.  resize(nReads);
-    quality.   resize(nReads);
+void packPrefixes(size_t width){
+    prefixes.resize(nReads);
+    for(size_t read=0; read<nReads; read++)
+        prefixes[read] = packPrefix(fastq.sequence(read).c_str(), fastq.sequence(read).length(), width);
+}
 
+int readPrefixes(const char *fileName, size_t width){
+    FastqStream stream;
+    if( stream.open(fileName) ) return -1;
+    while( stream.next() )
+        prefixes.push_back( packPrefix(stream.sequence().c_str(), stream.sequence().length(), width) );
+    prefixes.shrink_to_fit();
+    nReads = prefixes.size();
     return 0;
 }
-#undef NREC
 ///////////////////////////////////////////////////////////////////////
 
 
 
 
-////////////////////// union-find data structure //////////////////////
-class UnionFind {
-private:
-    map<int,int>         node2cluster;
-    map<int, list<int> > cluster2nodes;
+/////////////// clusters shared by all threads ////////////////////////
 
-public:
+// clusters of all reads
+ConcurrentUnionFind *uf;
+///////////////////////////////////////////////////////////////////////
 
-    int joinClusters(int cluster1, int cluster2){
-        if( cluster1 == cluster2 ) return cluster1;
-        list<int> &nodes1 = cluster2nodes[cluster1];
-        list<int> &nodes2 = cluster2nodes[cluster2];
-        size_t size1 = nodes1.size();
-        size_t size2 = nodes2.size();
-        if( size1==0 || size2==0 ) return 0;
-        int newCluster = 0;
-        if( size1 < size2 ){
-            newCluster = cluster2;
-            for(list<int>::const_iterator n = nodes1.begin(); n != nodes1.end(); n++)
-                node2cluster[*n] = newCluster;
-            nodes2.insert(nodes2.end(),nodes1.begin(),nodes1.end());
-            cluster2nodes.erase(cluster1);
-        } else {
-            newCluster = cluster1;
-            for(list<int>::const_iterator n = nodes2.begin(); n != nodes2.end(); n++)
-                node2cluster[*n] = newCluster;
-            nodes1.insert(nodes1.end(),nodes2.begin(),nodes2.end());
-            cluster2nodes.erase(cluster2);
-        }
-        return 0;
-    }
 
-    int findCluster(int node) { return node2cluster[node]; }
 
-    int nClusters(void) const { return cluster2nodes.size(); }
 
-    const map<int, list<int> >& clusters(void) const { return cluster2nodes; }
+/////////////// patterns shared by all threads ////////////////////////
 
-    UnionFind(const list<int> &nodes){
-        for(list<int>::const_iterator i=nodes.begin(); i!=nodes.end(); i++){
-             node2cluster [*i] = *i;
-             cluster2nodes[*i].push_back(*i);
+// pattern -> read (numbered from 1) where the pattern was found first; open addressing with linear
+//  probing in a table that never fills more than a half, a free slot is claimed by a compare-and-swap
+class PatternIndex {
+private:
+    static const unsigned long long EMPTY = ~0ULL; // patterns occupy at most 62 bits
+    vector< atomic<unsigned long long> > keys;
+    vector< atomic<int> >                reads; // 0 until the thread that claimed the slot stores its read
+    size_t mask;
+    int    shift; // the top bits of the product make the (Fibonacci) hash
+
+public:
+    // returns 0 if the pattern is new or the read that showed it first
+    int insert(unsigned long long pattern, int read){
+        size_t slot = (pattern * 0x9E3779B97F4A7C15ULL) >> shift;
+        while( 1 ){
+            unsigned long long key = keys[slot].load();
+            if( key == EMPTY ){
+                if( keys[slot].compare_exchange_strong(key, pattern) ){
+                    reads[slot].store(read);
+                    return 0;
+                }
+                // otherwise 'key' is the pattern of a thread that got there first
+            }
+            if( key == pattern ){
+                int first;
+                // the owner of the slot is only one store away
+                while( (first = reads[slot].load()) == 0 ) ;
+                return first;
+            }
+            slot = (slot + 1) & mask;
         }
     }
 
-    UnionFind(int maxNodes){
-        for(int i=1; i<=maxNodes; i++){
-             node2cluster [i] = i;
-             cluster2nodes[i].push_back(i);
+    // returns 0 if the pattern was not seen yet or the read that showed it first
+    int find(unsigned long long pattern) const {
+        size_t slot = (pattern * 0x9E3779B97F4A7C15ULL) >> shift;
+        while( 1 ){
+            unsigned long long key = keys[slot].load();
+            if( key == EMPTY ) return 0;
+            if( key == pattern ){
+                int first;
+                while( (first = reads[slot].load()) == 0 ) ;
+                return first;
+            }
+            slot = (slot + 1) & mask;
         }
     }
 
-    UnionFind(int begin, int end){
-        if( begin >= end || begin <= 0 ) exit(0);
-        for(int i=begin; i<end; i++){
-             node2cluster [i] = i;
-             cluster2nodes[i].push_back(i);
-        }
+    PatternIndex(size_t maxPatterns){
+        size_t size = 1024;
+        shift = 64 - 10;
+        while( size < 2*maxPatterns ){ size <<= 1; shift--; }
+        keys  = vector< atomic<unsigned long long> >(size);
+        reads = vector< atomic<int> >(size);
+        for(size_t i=0; i<size; i++){ keys[i].store(EMPTY); reads[i].store(0); }
+        mask = size - 1;
     }
 };
 
-// blocks of clusters
-#define MAX_BLOCKS (100)
-UnionFind* uf[MAX_BLOCKS];
+PatternIndex *patterns;
 ///////////////////////////////////////////////////////////////////////
 
 
@@ -142,206 +162,123 @@ UnionFind* uf[MAX_BLOCKS];
 // check first 'barcodeWidth' positions and request identity of 'viewWidth' consecutive symbols
 size_t barcodeWidth;// = 12;
 size_t viewWidth;//    = 10;
-
-// check all reads after the 'read' and combine those with similar beginnings
-bool groupMatchesFor(size_t read, size_t block, size_t till=nReads){
-    // do nothing if read doesn't exist
-    if( read >= nReads ) return true;
-
-    // reference sequence
-    const char *refSeq = sequence[read].c_str();
-
-    // do nothing for short sequences
-    if( strlen(refSeq) < barcodeWidth ) return true;
-
-    // break the read into patterns of viewWidth size
-    char matchPattern[MAX_ADAPTORS][MAX_LENGTH];
-    bzero(matchPattern, sizeof(matchPattern));
-
-    for(size_t i=0; i<barcodeWidth-viewWidth; i++){
-        if( i>=MAX_ADAPTORS ){ cerr<<"Long record ... exiting"<<endl; return false; }
-        strncpy( matchPattern[ i ], refSeq+i, viewWidth );
-        matchPattern[ i ][ viewWidth ] = '\0';
-    }
-
-    // build the hash from the patterns
-    LookUpTable lookUp(matchPattern);
-    // check if it is good
-    size_t maxCollisions = 0;
-    lookUp.countCollisions( maxCollisions );
-    if( maxCollisions >= MAX_COLLISIONS ) return false; // do not tolerate broken LUT
-
-    // look for other reads matching any of the patterns of the reference record
-    for(size_t read2=read+1; read2<till && read2<nReads; read2++){
-
-        // probe sequence
-        const char *probSeq = sequence[read2].c_str();
-
-        // ignore short sequences
-        if( strlen(probSeq) < barcodeWidth ) continue;
-
-        // expect barcodes showing only in the beginning and ignore the rest of the sequence 
-        char beginning[barcodeWidth+1];
-        strncpy(beginning,probSeq,barcodeWidth);
-        beginning[barcodeWidth] = '\0';
-
-        NumericSequence numSeq(beginning);
-
+// patterns that differ in up to 'maxMismatches' symbols match as well
+size_t maxMismatches;// = 0;
+
+// every pattern of the read's beginning is looked up among the patterns seen so far by all threads,
+//  the read joins the cluster of the read that showed the pattern first
+bool groupMatches(size_t begin, size_t end){
+    const unsigned long long viewMask = (1ULL<<(2*viewWidth)) - 1;
+    const unsigned int       badMask  = (1ULL<<viewWidth) - 1;
+    vector<unsigned long long> neighbours;
+
+    for(size_t read=begin; read<end && read<nReads; read++){
+        const Prefix &prefix = prefixes[read];
         for(size_t pos=0; pos<barcodeWidth-viewWidth; pos++){
-            unsigned long long view = numSeq.view(pos,viewWidth);
-            size_t matchLength = viewWidth;
-            if( lookUp.find(view,matchLength) != MAX_ADAPTORS ){ // found a match
-                int cluster1 = uf[block]->findCluster(read+1);
-                int cluster2 = uf[block]->findCluster(read2+1);
-                if( cluster1 != cluster2 ) uf[block]->joinClusters(cluster1,cluster2);
+            // do not match on non-interpretable symbols
+            if( (prefix.bad>>pos) & badMask ) continue;
+
+            unsigned long long view = (prefix.code>>(2*pos)) & viewMask;
+            int first = patterns->insert(view, read+1);
+            if( first ) uf->joinClusters(first, read+1); // found a match
+
+            if( !maxMismatches ) continue;
+            // the pattern is inserted before its neighbours are looked up: of two close reads
+            //  processed at the same time at least one sees the other
+            neighbours.clear();
+            hammingNeighbours(view, viewWidth, maxMismatches, neighbours);
+            for(size_t n=1; n<neighbours.size(); n++){ // the first one is the pattern itself
+                int close = patterns->find(neighbours[n]);
+                if( close ) uf->joinClusters(close, read+1);
             }
         }
     }
     return true;
 }
 // parent function of the thread
-bool processReads(size_t begin, size_t end, size_t block){
+bool processReads(size_t begin, size_t end){
      // safety
      if( begin>=end ) return false;
-     // safety once again
-     if( uf[block] ){
-         cerr<<"More than one call to process block #"<<block<<endl;
-         return false;
-     }
-     // initialize data structure for clustering
-     uf[block] = new UnionFind(begin+1, end+1); //remember to start numbering from 1
      // build clusters
-     for(size_t read=begin; read<end; read++)
-         if( !groupMatchesFor(read,block,end) ) return false;
-
-     return true;
+     return groupMatches(begin,end);
 }
 ///////////////////////////////////////////////////////////////////////
 
 
-/////////////// merge clusters from different blocks //////////////////
-
-// for each cluster leader of the block build a look up table 
-map<int,LookUpTable> buildSearchHelper(const UnionFind &uf){
-    // all clusters for this block
-    const map<int, list<int> > &clusters = uf.clusters();
 
-    // association of cluster leader and lut built of all of the search patterns
-    map<int,LookUpTable> retval;
 
-    // for each cluster
-    for(auto &clust : clusters){
+/////////////// writing the clusters out ///////////////////////////////
 
-        // cluster leader
-        int leader = clust.first - 1; // remember that UnionFind numeration starts from 1
-        const list<int> &children = clust.second;
-
-        // safety
-        if( sequence[leader].length() < barcodeWidth ) continue;
-        if( children.size() == 0 ){
-            cerr<<" Error: empty cluster for "<<leader<<"!"<<endl;
-            exit(0);
-        }
-
-        // construct a set of search patterns
-        set<string> patterns;
-        // start with the leader 
-        for(size_t pos=0; pos<barcodeWidth-viewWidth; pos++){
-            if( pos>=MAX_ADAPTORS ){
-                cerr<<"Long record ... exiting"<<endl;
-                exit(0);
-            }
-            patterns.insert( sequence[leader].substr(pos,viewWidth) );
-        }
+// the big clusters get their own files and the rest go to the ungrouped file
+const char *suffix = ".fastq";
 
-        // do the same for every child
-        for(auto &child : children){
-            // split sequence beginning into search patterns
-            for(size_t pos=0; pos<barcodeWidth-viewWidth; pos++){
-                if( pos>=MAX_ADAPTORS ){
-                    cerr<<"Long record ... exiting"<<endl;
-                    exit(0);
-                }
-                patterns.insert( sequence[child-1].substr(pos,viewWidth) );
-            }
-        }
-        // safety
-        if( patterns.size() >= MAX_ADAPTORS ){
-            cerr<<"Too many search patterns: "<<patterns.size()<<endl;
-            exit(0);
-        } 
-
-        // convert patterns into the format accepted by the LookUpTable 
-        char matchPattern[MAX_ADAPTORS][MAX_LENGTH];
-        bzero(matchPattern, sizeof(matchPattern));
-        size_t p=0;
-        for(auto &pat : patterns){
-            strncpy(matchPattern[p],pat.c_str(),viewWidth);
-            matchPattern[p][viewWidth] = '\0';
-            p++;
-        }
+string outputName(int leader){
+    stringstream fname;
+    fname<<"output"<<leader<<suffix;
+    return fname.str();
+}
 
-        pair< map<int,LookUpTable>::iterator, bool> res = retval.insert( pair<int,LookUpTable>( leader+1, LookUpTable(matchPattern) ) );
-        if( !res.second ){ cerr<<"Duplicate leader ... exiting"<<endl; exit(0); }
-
-        // check quality of the hash table
-        size_t maxCollisions = 0;
-        res.first->second.countCollisions( maxCollisions );
-        if( maxCollisions >= MAX_COLLISIONS ){
-//            for(size_t k=0; k<MAX_ADAPTORS; k++){
-//                size_t length = strlen( matchPattern[k] );
-//                if( length > 0 ){
-//                    unsigned short errorPos = 0;
-//                    unsigned long long coreCode = sequence2number(matchPattern[k],strlen(matchPattern[k]),errorPos);
-//                    printf("%ld: %s, bucket: %lld\n",k,matchPattern[k],coreCode % BUCKETS);
-//                }
-//            }
-            exit(0); // do not tolerate broken LUT
-        }
+// every cluster file is written by a worker of the pool, the small clusters are collected by one more worker
+void writeClusters(const vector<ConcurrentUnionFind::Cluster> &clusters, size_t threshold, ThreadPool &pool){
+    const bool compress = string(suffix) != ".fastq";
+
+    pool.submit( [&clusters,threshold,compress]{
+        FastqWriter ungrouped;
+        if( ungrouped.open( (string("ungrouped")+suffix).c_str(), compress ) ) return;
+        for(auto &children : clusters)
+            if( children.size() < threshold )
+                for(auto read : children)
+                    ungrouped.write(fastq.identifier(read-1), fastq.sequence(read-1), fastq.quality(read-1));
+        if( ungrouped.close() ) cerr<<"Cannot write ungrouped"<<suffix<<endl;
+    } );
+
+    for(auto &children : clusters){
+        if( children.size() < threshold ) continue;
+
+        const ConcurrentUnionFind::Cluster *cluster = &children;
+        pool.submit( [cluster,compress]{
+            string fname = outputName(cluster->leader-1);
+            FastqWriter out;
+            if( out.open(fname.c_str(), compress) ) return;
+            for(auto read : *cluster)
+                out.write(fastq.identifier(read-1), fastq.sequence(read-1), fastq.quality(read-1));
+            if( out.close() ) cerr<<"Cannot write "<<fname<<endl;
+        } );
     }
-
-    return retval;
+    pool.wait();
 }
 
-// mutex for the data stracture preventing data race
-std::mutex mtx;
-UnionFind *joinedGroup;
-
-bool mergeGroups(const UnionFind &group1, const UnionFind &group2){
-
-    // build helpers: relatively fast, but costs memory -> do it on demand and destroy after using
-    map<int,LookUpTable> searchHelper1 = buildSearchHelper(group1);
-    map<int,LookUpTable> searchHelper2 = buildSearchHelper(group2);
-
-    // for every cluster of the first group 
-    for(auto &cluster1 : searchHelper1){
+// second pass of the streaming mode: every record goes to the file of its cluster in the order of
+//  the input, full buffers are written (and compressed) by the workers of the pool
+int routeReads(const char *fileName, const vector<ConcurrentUnionFind::Cluster> &clusters, size_t threshold, ThreadPool &pool){
+    const bool compress = string(suffix) != ".fastq";
 
-        size_t leader1           = cluster1.first;
-        const  LookUpTable &lut1 = cluster1.second;
+    // read -> output file; the writers opened before an early return are closed by their destructors
+    vector< unique_ptr<FastqWriter> > outputs;
+    vector<int> route(nReads, 0);
 
-        // compare it with every cluster of the second group
-        for(auto &cluster2 : searchHelper2){
+    outputs.push_back( unique_ptr<FastqWriter>( new FastqWriter() ) );
+    if( outputs[0]->open( (string("ungrouped")+suffix).c_str(), compress, &pool ) ) return -1;
 
-            size_t leader2           = cluster2.first;
-            const  LookUpTable &lut2 = cluster2.second;
+    for(auto &children : clusters){
+        if( children.size() < threshold ) continue;
 
-            bool match = false;
-            if( lut1.size() > lut2.size() )
-                match = lut2.match( lut1 );
-            else
-                match = lut1.match( lut2 );
+        outputs.push_back( unique_ptr<FastqWriter>( new FastqWriter() ) );
+        if( outputs.back()->open( outputName(children.leader-1).c_str(), compress, &pool ) ) return -1;
 
-            if( match ){
-                mtx.lock();
-                int cluster1 = joinedGroup->findCluster(leader1);
-                int cluster2 = joinedGroup->findCluster(leader2);
-                if( cluster1 != cluster2 ) joinedGroup->joinClusters(cluster1,cluster2);
-                mtx.unlock();
-            }
-        }
+        for(auto read : children) route[read-1] = outputs.size()-1;
     }
 
-    return true;
+    FastqStream stream;
+    if( stream.open(fileName) ) return -1;
+    for(size_t read=0; read<nReads && stream.next(); read++)
+        outputs[ route[read] ]->write(stream.identifier(), stream.sequence(), stream.quality());
+
+    int status = 0;
+    for(size_t i=0; i<outputs.size(); i++)
+        if( outputs[i]->close() ) status = -1;
+    if( status ) cerr<<"Cannot write the output"<<endl;
+    return status;
 }
 ///////////////////////////////////////////////////////////////////////
 
@@ -359,6 +296,9 @@ int main(int argc, char *argv[]){
        {"threshold",    1, 0, 't'},
        {"width",        1, 0, 'w'},
        {"length",       1, 0, 'l'},
+       {"stream",       0, 0, 's'},
+       {"gzip",         0, 0, 'z'},
+       {"mismatches",   1, 0, 'd'},
        {0, 0, 0, 0}
     };
 
@@ -375,21 +315,25 @@ int main(int argc, char *argv[]){
     // global defaults
     barcodeWidth = 12; 
     viewWidth    = 10; 
+    maxMismatches = 0;
 
     while( 1 ){
        int index=0;
-       int c = getopt_long(argc, argv, "hi:c:n:t:w:l:",options, &index);
+       int c = getopt_long(argc, argv, "hi:c:n:t:w:l:szd:",options, &index);
        if( c == -1 ) break;
        switch( tolower(c) ) {
            case 'h':
                cout<<"Usage:"<<endl;
                cout<<"-h     ,   --help              show this message"<<endl;
-               cout<<"-i     ,   --input             FASTQ input file"<<endl;
+               cout<<"-i     ,   --input             FASTQ input file (plain, gzip or BGZF)"<<endl;
                cout<<"-c     ,   --cores             Number of CPU cores [defailt=1]"<<endl;
                cout<<"-n     ,   --nreads            Number of reads to process in one block [default=10000]"<<endl;
                cout<<"-t     ,   --threshold         Minimal cluster size to write in a separate file [default=1000]"<<endl;
                cout<<"-l     ,   --length            Number of consecutive matches in a pattern [default=10]"<<endl;
                cout<<"-w     ,   --width             Search window in the beginning of a sequence [default=12]"<<endl;
+               cout<<"-d     ,   --mismatches        Number of mismatches tolerated in a pattern [default=0]"<<endl;
+               cout<<"-s     ,   --stream            Keep only the beginnings of the reads and read the input twice"<<endl;
+               cout<<"-z     ,   --gzip              Compress the output files"<<endl;
                return 0;
            break;
            case 'i':
@@ -410,6 +354,15 @@ int main(int argc, char *argv[]){
            case 'l':
                viewWidth = strtoul(optarg,NULL,0);
            break;
+           case 's':
+               streaming = true;
+           break;
+           case 'z':
+               suffix = ".fastq.gz";
+           break;
+           case 'd':
+               maxMismatches = strtoul(optarg,NULL,0);
+           break;
            default : cout<<"Type -h for help"<<endl; return 0;
        }
     }
@@ -420,18 +373,36 @@ int main(int argc, char *argv[]){
         cerr<<" viewWidth (-l) < barcodeWidth (-w) make sure "<<endl;
         return 0;
     }
+    // patterns are packed in 2 bits per symbol leaving the all-ones key free
+    if( viewWidth > 31 ){
+        cerr<<" viewWidth (-l) cannot exceed 31 "<<endl;
+        return 0;
+    }
 
-    if( readFile(fastqFile) ) return 0;
-    else cout<<"Reads: "<<nReads<<endl;
-
-    const size_t nBlocks = nReads/readsInBlock + 1;
-    if( nBlocks >= MAX_BLOCKS ){
-        cerr<<"Too many blocks requested (>"<<MAX_BLOCKS<<")"<<endl;
+    // the packed beginning has to fit in 64 bits
+    if( barcodeWidth > 32 ){
+        cerr<<" barcodeWidth (-w) cannot exceed 32 "<<endl;
         return 0;
     }
 
-    const size_t maxNumThreads = nCores;
-    std::future<bool> results [ maxNumThreads ];
+    if( streaming ){
+        if( readPrefixes(fastqFile, barcodeWidth) ) return 0;
+    } else {
+        if( readFile(fastqFile, nCores) ) return 0;
+        packPrefixes(barcodeWidth);
+    }
+    cout<<"Reads: "<<nReads<<endl;
+
+    if( readsInBlock < 1 ) return 0;
+    const size_t nBlocks = (nReads + readsInBlock - 1)/readsInBlock;
+
+    // all threads share a single clustering and a single index of patterns
+    uf = new ConcurrentUnionFind(nReads);
+    size_t maxPatterns = nReads*(barcodeWidth-viewWidth);
+    if( viewWidth < 16 && maxPatterns > (1ULL<<(2*viewWidth)) ) maxPatterns = 1ULL<<(2*viewWidth);
+    patterns = new PatternIndex(maxPatterns);
+
+    ThreadPool pool(nCores);
 
     for(size_t block=0; block<nBlocks; block++){
 
@@ -440,109 +411,33 @@ int main(int argc, char *argv[]){
         size_t end   = readsInBlock*(block + 1);
         if( end > nReads ) end = nReads;
 
-        // identify a free thread
-        size_t freeThread = 0;
-        for( ;  results[freeThread].valid() &&
-                results[freeThread].wait_for(std::chrono::milliseconds(100)) != std::future_status::ready ; )
-            if( freeThread == maxNumThreads-1 ) freeThread = 0; else freeThread++;
-
         cout<<"Processing block: "<<block<<" ["<<begin<<" - "<<end<<")"<<endl;
 
         // submit
-        results[freeThread] = std::async(std::launch::async, processReads, begin, end, block);
+        pool.submit( [begin,end]{ processReads(begin,end); } );
     }
 
-    // wait until all threads finish
-    for(size_t thr=0; thr<maxNumThreads; thr++)
-        if( results[thr].valid() ) results[thr].wait();
-
-    // report number of clusters in each block
-    for(size_t block=0; block<nBlocks; block++)
-        cout<<"Found "<<uf[block]->nClusters()<<" clusters in block #"<<block<<endl;
-
-    // group clusters together 
-    list<int> leaders;
-    for(size_t block=0; block<nBlocks; block++){
-        const map<int, list<int> > &clusters = uf[block]->clusters();
-        for(auto clust : clusters)
-            leaders.push_back(clust.first);
-    }
-
-    joinedGroup = new UnionFind(leaders);
-
-    for(size_t block1=0; block1+1<nBlocks; block1++){
-        cout<<"Grouping block "<<block1<<endl;
-        for(size_t block2=block1+1; block2<nBlocks; block2++){
-
-            // identify a free thread
-            size_t freeThread = 0;
-            for( ;  results[freeThread].valid() &&
-                    results[freeThread].wait_for(std::chrono::milliseconds(100)) != std::future_status::ready ;
-                    freeThread++ )
-                if( freeThread == maxNumThreads-1 ) freeThread = 0;
+    // wait until all blocks are done
+    pool.wait();
 
-            cout<<" with block "<<block2<<endl;
+    delete patterns;
+    vector<Prefix>().swap(prefixes);
 
-            // submit
-            results[freeThread] = std::async(std::launch::async, mergeGroups, *uf[block1], *uf[block2]);
-        }
-    }
-
-    // wait until all threads finish
-    for(size_t thr=0; thr<maxNumThreads; thr++)
-        if( results[thr].valid() ) results[thr].wait();
-
-    cout<<"Found "<<joinedGroup->nClusters()<<" superclusters "<<endl;
+    cout<<"Found "<<uf->nClusters()<<" superclusters "<<endl;
 
 
     ofstream output("clustering.csv");
     if( !output ){ cout<<"Cannot open clustering.csv"<<endl; return 0; }
 
-    ofstream ungrouped("ungrouped.fastq");
-    if( !ungrouped ){ cout<<"Cannot open ungrouped.fastq"<<endl; return 0; }
-
-    const map<int, list<int> > &superClusters = joinedGroup->clusters();
-    for(auto &sc : superClusters){
-        int leader = sc.first-1;
-        list<int> children;
-
-        for(auto clust : sc.second){
-            size_t block = (clust-1)/readsInBlock;
-            map<int, list<int> >::const_iterator c = uf[block]->clusters().find(clust);
-            if( c != uf[block]->clusters().end() )
-                children.insert( children.end(), c->second.begin(), c->second.end() );
-            else {
-                cerr<<"Problem"<<endl;
-                exit(0);
-            }
-        }
-        if( children.size() == 0 ) cerr<<" Error: empty cluster for "<<leader+1<<"!"<<endl;
-        output<<leader<<","<<children.size()<<endl;
-
-        if( children.size() < threshold ){
-            for(auto read : children ){
-                ungrouped<<identifier[read-1]<<endl;
-                ungrouped<<sequence  [read-1]<<endl;
-                ungrouped<<"+"<<endl;
-                ungrouped<<quality   [read-1]<<endl;
-            }
-        } else {
-
-            stringstream fname;
-            fname<<"output"<<leader<<".fastq";
-            ofstream out(fname.str());
-            if( !out ){ cerr<<"Cannot open "<<fname.str()<<endl; return 0; }
-
-            for(auto read : children){
-                out<<identifier[read-1]<<endl;
-                out<<sequence  [read-1]<<endl;
-                out<<"+"<<endl;
-                out<<quality   [read-1]<<endl;
-            }
-        }
-    }
+    const vector<ConcurrentUnionFind::Cluster> &superClusters = uf->clusters();
+    for(auto &children : superClusters)
+        output<<children.leader-1<<","<<children.size()<<"\n";
     output.close();
-    ungrouped.close();
+
+    if( streaming ){
+        if( routeReads(fastqFile, superClusters, threshold, pool) ) return 1;
+    } else
+        writeClusters(superClusters, threshold, pool);
 
     return 0;
 }
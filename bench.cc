@@ -0,0 +1,328 @@
+#include <stdio.h>  // sscanf
+#include <stdlib.h> // strtoul
+#include <math.h>   // sqrt
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <random>
+#include <chrono>
+
+#include <getopt.h>
+#include <sys/resource.h> // getrusage
+
+using namespace std;
+#include "DNASequencing.cc"
+
+// Compile with:
+// g++ -g -O2 -Wall -std=c++11 -o bench bench.cc
+
+// DNASequencing is tuned for the reads of fixed length
+const size_t readLength = 150;
+
+////////////////////// reference genome //////////////////////
+
+// every record of the FASTA file is a separate chromatid (up to 25)
+vector< vector<string> > chromatidLines;
+vector<string>           chromatidSequence;
+
+int readReference(const char *fileName){
+
+    ifstream input(fileName);
+    if(!input){ cerr<<"Cannot open "<<fileName<<endl; return -1; }
+
+    string line;
+    while( getline(input, line, '\n') ){
+        if( line.length() && line[0] == '>' ){
+            if( chromatidLines.size() == 25 ){ cerr<<"Only first 25 records of "<<fileName<<" are used"<<endl; break; }
+            chromatidLines.push_back( vector<string>() );
+            chromatidSequence.push_back( string() );
+            continue;
+        }
+        if( chromatidLines.size() == 0 ) continue;
+        chromatidLines.back().push_back(line);
+        if( line.length() && line[line.length()-1] == '\r' ) line.erase(line.length()-1);
+        chromatidSequence.back().append(line);
+    }
+    input.close();
+
+    if( chromatidLines.size() == 0 ){ cerr<<"No records found in "<<fileName<<endl; return -1; }
+
+    return 0;
+}
+///////////////////////////////////////////////////////////////////////
+
+
+
+////////////////////// paired reads simulation //////////////////////
+
+// where the pair comes from
+struct Truth {
+    int    chId;
+    size_t begin1, end1; // 1-based inclusive coordinates as reported by DNASequencing
+    size_t begin2, end2;
+    bool   revCompl;     // first read of the pair maps to the '-' strand
+};
+
+const char bases[4] = {'A','C','G','T'};
+
+// copy 'length' bases of the reference starting at 'start' introducing random mismatches and single base indels
+//  returns the reference position following the last consumed base
+size_t mutate(const string &ref, size_t start, size_t length, double misRate, double indelRate, mt19937 &engine, string &read){
+    uniform_real_distribution<double> flat(0,1);
+    uniform_int_distribution<int>     base(0,3);
+
+    read.clear();
+    size_t pos = start;
+    while( read.length() < length && pos < ref.length() ){
+        double r = flat(engine);
+        if( r < indelRate/2 ){        // deletion from the read
+            pos++;
+        } else if( r < indelRate ){   // insertion into the read
+            read += bases[ base(engine) ];
+        } else if( r < indelRate + misRate ){
+            char b = bases[ base(engine) ];
+            while( b == ref[pos] ) b = bases[ base(engine) ];
+            read += b;
+            pos++;
+        } else
+            read += ref[pos++];
+    }
+    return pos;
+}
+
+string reverseComplement(const string &seq){
+    string retval;
+    for(int pos = seq.length()-1; pos >= 0; pos--)
+        retval += complement[ (unsigned char)seq[pos] ];
+    return retval;
+}
+
+// fragments of 'insertSize' +- 'insertSD' bases, reads taken from both ends facing each other
+int simulate(size_t nPairs, double misRate, double indelRate, double insertSize, double insertSD, unsigned seed,
+             vector<string> &readName, vector<string> &readSequence, vector<Truth> &truth){
+
+    mt19937 engine(seed);
+
+    // pick chromatids proportionally to their lengths
+    vector<double> weights;
+    for(auto &seq : chromatidSequence) weights.push_back( seq.length() );
+    discrete_distribution<int>   chromatid(weights.begin(), weights.end());
+    normal_distribution<double>  insert(insertSize, insertSD);
+    uniform_int_distribution<int> coin(0,1);
+
+    for(size_t pair=0; pair<nPairs; pair++){
+
+        Truth t;
+        string read1, read2;
+
+        size_t attempt = 0;
+        for( ; attempt<1000; attempt++){
+            t.chId = chromatid(engine);
+            const string &ref = chromatidSequence[t.chId];
+
+            size_t fragment = (size_t)insert(engine);
+            if( fragment < readLength + 20 ) fragment = readLength + 20; // leave some room for deletions
+            if( ref.length() < fragment + 20 ) continue;
+
+            size_t start = uniform_int_distribution<size_t>(0, ref.length() - fragment - 20)(engine);
+            // no ambiguous bases in the simulated fragment
+            if( ref.find_first_not_of("ACGT", start) < start + fragment + 20 ) continue;
+
+            string left, right;
+            size_t leftEnd  = mutate(ref, start,                        readLength, misRate, indelRate, engine, left);
+            size_t rightEnd = mutate(ref, start + fragment - readLength, readLength, misRate, indelRate, engine, right);
+            if( left.length() != readLength || right.length() != readLength ) continue;
+
+            // the pair is sequenced either from the '+' or from the '-' strand
+            t.revCompl = coin(engine);
+            if( !t.revCompl ){
+                read1    = left;
+                read2    = reverseComplement(right);
+                t.begin1 = start + 1;
+                t.end1   = leftEnd;
+                t.begin2 = start + fragment - readLength + 1;
+                t.end2   = rightEnd;
+            } else {
+                read1    = reverseComplement(right);
+                read2    = left;
+                t.begin1 = start + fragment - readLength + 1;
+                t.end1   = rightEnd;
+                t.begin2 = start + 1;
+                t.end2   = leftEnd;
+            }
+            break;
+        }
+        if( attempt == 1000 ){ cerr<<"Reference is too short or too ambiguous for the requested inserts"<<endl; return -1; }
+
+        char name[64];
+        sprintf(name,"sim%ld/1",pair);
+        readName.push_back(name);
+        readSequence.push_back(read1);
+        sprintf(name,"sim%ld/2",pair);
+        readName.push_back(name);
+        readSequence.push_back(read2);
+        truth.push_back(t);
+    }
+
+    return 0;
+}
+///////////////////////////////////////////////////////////////////////
+
+
+
+// compare "name,chId,begin,end,strand,probability" with the truth
+bool isCorrect(const string &alignment, int chId, size_t begin, char strand, size_t tolerance){
+    size_t comma = alignment.find(',');
+    if( comma == string::npos ) return false;
+    int  ch = -1;
+    long b = 0, e = 0;
+    char s = ' ';
+    if( sscanf(alignment.c_str()+comma+1, "%d,%ld,%ld,%c", &ch, &b, &e, &s) != 4 ) return false;
+    return ch == chId && s == strand && labs(b - long(begin)) <= long(tolerance);
+}
+
+int main(int argc, char *argv[]){
+
+    // parse the options
+    static struct option options[] = {
+       {"help",         0, 0, 'h'},
+       {"reference",    1, 0, 'r'},
+       {"npairs",       1, 0, 'n'},
+       {"mismatches",   1, 0, 'm'},
+       {"indels",       1, 0, 'd'},
+       {"insert",       1, 0, 'i'},
+       {"sd",           1, 0, 's'},
+       {"seed",         1, 0, 'e'},
+       {"test",         1, 0, 't'},
+       {"accurate",     0, 0, 'a'},
+       {"pages",        1, 0, 'p'},
+       {"interleave",   0, 0, 'l'},
+       {"tolerance",    1, 0, 'o'},
+       {"json",         1, 0, 'j'},
+       {0, 0, 0, 0}
+    };
+
+    cout<<"Running: ";
+    for(int arg=0; arg<argc; arg++) cout<<argv[arg]<<" ";
+    cout<<endl;
+
+    // defaults
+    char  *refFile    = 0;
+    size_t nPairs     = 1000;
+    double misRate    = 0.003;
+    double indelRate  = 0.001;
+    double insertSize = 450;
+    double insertSD   = 50;
+    unsigned seed     = 1;
+    int    difficulty = 0;
+    bool   accurate   = false;
+    int    pages      = IndexArena::TRANSPARENT_HUGE_PAGES;
+    bool   interleave = false;
+    size_t tolerance  = 300;
+    char  *jsonFile   = 0;
+
+    while( 1 ){
+       int index=0;
+       int c = getopt_long(argc, argv, "hr:n:m:d:i:s:e:t:ap:lo:j:",options, &index);
+       if( c == -1 ) break;
+       switch( c ) {
+           case 'h':
+               cout<<"Usage:"<<endl;
+               cout<<"-h     ,   --help              show this message"<<endl;
+               cout<<"-r     ,   --reference         FASTA reference, one chromatid per record"<<endl;
+               cout<<"-n     ,   --npairs            Number of simulated read pairs [default=1000]"<<endl;
+               cout<<"-m     ,   --mismatches        Mismatch rate per base [default=0.003]"<<endl;
+               cout<<"-d     ,   --indels            Single base indel rate per base [default=0.001]"<<endl;
+               cout<<"-i     ,   --insert            Mean fragment length [default=450]"<<endl;
+               cout<<"-s     ,   --sd                Standard deviation of the fragment length [default=50]"<<endl;
+               cout<<"-e     ,   --seed              Random seed [default=1]"<<endl;
+               cout<<"-t     ,   --test              Test difficulty passed to initTest [default=0]"<<endl;
+               cout<<"-a     ,   --accurate          Use alignAccurate instead of alignFast"<<endl;
+               cout<<"-p     ,   --pages             Index memory: 0 - small, 1 - transparent huge, 2 - explicit huge pages [default=1]"<<endl;
+               cout<<"-l     ,   --interleave        Interleave the index over all NUMA nodes"<<endl;
+               cout<<"-o     ,   --tolerance         Maximal distance of a correct alignment from the truth [default=300]"<<endl;
+               cout<<"-j     ,   --json              Dump the aligner's hot path counters into this file"<<endl;
+               return 0;
+           break;
+           case 'r': refFile    = optarg; break;
+           case 'n': nPairs     = strtoul(optarg,NULL,0); break;
+           case 'm': misRate    = strtod (optarg,NULL);   break;
+           case 'd': indelRate  = strtod (optarg,NULL);   break;
+           case 'i': insertSize = strtod (optarg,NULL);   break;
+           case 's': insertSD   = strtod (optarg,NULL);   break;
+           case 'e': seed       = strtoul(optarg,NULL,0); break;
+           case 't': difficulty = strtol (optarg,NULL,0); break;
+           case 'a': accurate   = true; break;
+           case 'p': pages      = strtol (optarg,NULL,0); break;
+           case 'l': interleave = true; break;
+           case 'o': tolerance  = strtoul(optarg,NULL,0); break;
+           case 'j': jsonFile   = optarg; break;
+           default : cout<<"Type -h for help"<<endl; return 0;
+       }
+    }
+
+    if( !refFile ){
+        cerr<<"FASTA reference (-r) is required, type -h for help"<<endl;
+        return 1;
+    }
+    if( nPairs == 0 ){
+        cerr<<"Number of pairs (-n) should be at least 1"<<endl;
+        return 1;
+    }
+
+    if( readReference(refFile) ) return 0;
+
+    vector<string> readName, readSequence;
+    vector<Truth>  truth;
+    if( simulate(nPairs, misRate, indelRate, insertSize, insertSD, seed, readName, readSequence, truth) ) return 0;
+    cout<<"Simulated "<<nPairs<<" pairs from "<<chromatidSequence.size()<<" chromatid(s)"<<endl;
+
+    DNASequencing worker;
+    worker.initTest(difficulty);
+    worker.initMemory(IndexArena::Pages(pages), interleave ? IndexArena::INTERLEAVE_NODES : IndexArena::LOCAL_NODE);
+    worker.initAlignment(accurate, false);
+
+    chrono::steady_clock::time_point loadStarts = chrono::steady_clock::now();
+    for(size_t chId=0; chId<chromatidLines.size(); chId++)
+        worker.passReferenceGenome(chId, chromatidLines[chId]);
+    chromatidLines.clear();
+    worker.preProcessing();
+    double indexTime = chrono::duration<double>(chrono::steady_clock::now() - loadStarts).count();
+
+    chrono::steady_clock::time_point alignStarts = chrono::steady_clock::now();
+    vector<string> alignments = worker.getAlignment(2*nPairs, 0, 0, readName, readSequence);
+    double alignTime = chrono::duration<double>(chrono::steady_clock::now() - alignStarts).count();
+
+    size_t correctReads = 0, correctPairs = 0;
+    for(size_t pair=0; pair<nPairs && 2*pair+1<alignments.size(); pair++){
+        const Truth &t = truth[pair];
+        bool ok1 = isCorrect(alignments[2*pair],   t.chId, t.begin1, (t.revCompl?'-':'+'), tolerance);
+        bool ok2 = isCorrect(alignments[2*pair+1], t.chId, t.begin2, (t.revCompl?'+':'-'), tolerance);
+        correctReads += ok1 + ok2;
+        correctPairs += ok1 && ok2;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    AlignerStats stats = worker.statistics();
+    printf("Index build:     %.3f s\n", indexTime);
+    printf("Alignment:       %.3f s, %.1f pairs/s\n", alignTime, nPairs/alignTime);
+    printf("  seeding:       %.3f s, %lld look-ups, %lld hits\n", stats.seeding, stats.seedsProbed, stats.hitsReturned);
+    printf("  alignFast:     %.3f s, %lld calls\n", stats.alignFast, stats.alignFastCalls);
+    printf("  alignAccurate: %.3f s, %lld calls\n", stats.alignAccurate, stats.alignAccurateCalls);
+    printf("Peak memory:     %ld MB\n", usage.ru_maxrss/1024);
+    printf("Correct reads:   %ld / %ld (%.2f%%)\n", correctReads, 2*nPairs, 100.*correctReads/(2*nPairs));
+    printf("Correct pairs:   %ld / %ld (%.2f%%)\n", correctPairs, nPairs,   100.*correctPairs/nPairs);
+
+    if( jsonFile ){
+        ofstream json(jsonFile);
+        if( !json ){ cerr<<"Cannot open "<<jsonFile<<endl; return 0; }
+        worker.dumpStats(json);
+    }
+
+    return 0;
+}
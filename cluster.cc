@@ -5,52 +5,12 @@
 #include <fstream>
 #include <map>
 #include <list>
+
+#include "./unionfind.h"
 using namespace std;
 
 // g++ -g -Wall -o cluster cluster.cc
 
-class UnionFind {
-private:
-    map<int,int>         node2cluster;
-    map<int, list<int> > cluster2nodes;
-
-public:
-    int joinClusters(int cluster1, int cluster2){
-        if( cluster1 == cluster2 ) return cluster1;
-        list<int> &nodes1 = cluster2nodes[cluster1];
-        list<int> &nodes2 = cluster2nodes[cluster2];
-        if( nodes1.size()==0 || nodes2.size()==0 ) return 0;
-        int newCluster = 0;
-        if( nodes1.size() < nodes2.size() ){
-            newCluster = cluster2;
-            for(list<int>::const_iterator n = nodes1.begin(); n != nodes1.end(); n++)
-                node2cluster[*n] = newCluster;
-            nodes2.insert(nodes2.end(),nodes1.begin(),nodes1.end());
-            cluster2nodes.erase(cluster1);
-        } else {
-            newCluster = cluster1;
-            for(list<int>::const_iterator n = nodes2.begin(); n != nodes2.end(); n++)
-                node2cluster[*n] = newCluster;
-            nodes1.insert(nodes1.end(),nodes2.begin(),nodes2.end());
-            cluster2nodes.erase(cluster2);
-        }
-        return 0;
-    }
-
-    int findCluster(int node) { return node2cluster[node]; }
-
-    int nClusters(void) const { return cluster2nodes.size(); }
-
-    const map<int, list<int> >& clusters(void) const { return cluster2nodes; }
-
-    UnionFind(int maxNodes){
-        for(int i=1; i<=maxNodes; i++){
-             node2cluster [i] = i;
-             cluster2nodes[i].push_back(i);
-        }
-    }
-};
-
 int main(int argc, char *argv[]){
     unsigned int nReads = 84205;
 
@@ -92,11 +52,11 @@ int main(int argc, char *argv[]){
     ofstream output("clusters.csv");
     if( !output ){ cout<<"Cannot open clusters.csv"<<endl; return 0; }
     output<<"read1,read2,distance"<<endl;
-    const map<int, list<int> > &clusters = uf.clusters();
-    for(map<int, list<int> >::const_iterator iter = clusters.begin(); iter != clusters.end(); iter++){
-        int seed = iter->first;
-        if( iter->second.size() == 0 ) cerr<<" Error: empty cluster for "<<seed<<"!"<<endl;
-        for(list<int>::const_iterator node = iter->second.begin(); node != iter->second.end(); node++)
+    const vector<UnionFind::Cluster> &clusters = uf.clusters();
+    for(vector<UnionFind::Cluster>::const_iterator iter = clusters.begin(); iter != clusters.end(); iter++){
+        int seed = iter->leader;
+        if( iter->size() == 0 ) cerr<<" Error: empty cluster for "<<seed<<"!"<<endl;
+        for(const int *node = iter->begin(); node != iter->end(); node++)
             output<<seed-1<<","<<*node-1<<","<<edges2[seed][*node]<<endl;
     }
     output.close();
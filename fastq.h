@@ -0,0 +1,433 @@
+#ifndef FASTQ_H
+#define FASTQ_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "./threadpool.h"
+
+////////////////////// zero-copy FASTQ reader //////////////////////
+
+// One line of a record: it points into the mapped file where the line was NUL-terminated in place
+class FastqField {
+private:
+    const char *ptr;
+    size_t      len;
+public:
+    const char* c_str (void)     const { return ptr; }
+    size_t      length(void)     const { return len; }
+    char        operator[](size_t i) const { return ptr[i]; }
+
+    FastqField(const char *p, size_t l):ptr(p),len(l){}
+
+    friend std::ostream& operator<<(std::ostream &out, const FastqField &field){
+        return out.write(field.ptr, field.len);
+    }
+};
+
+// The whole file is mapped privately (copy-on-write) and the records are kept as offsets and
+//  lengths of their lines, so no memory is allocated per record and the lines are never copied.
+//  A gzip-compressed file is inflated in memory instead; the independent blocks of BGZF
+//  (blocked gzip of samtools/htslib) are inflated in parallel
+class FastqFile {
+private:
+    struct Record {
+        size_t   identifier, sequence, quality; // offsets of the lines
+        unsigned identifierLength, sequenceLength, qualityLength;
+    };
+    std::vector<Record> records;
+    char  *data;
+    size_t mapped; // size of the mapping or 0 if 'data' is allocated on the heap
+
+    // terminates the line starting at 'pos' and returns its length; 'pos' moves to the next line
+    size_t nextLine(size_t &pos, size_t fileSize){
+        size_t begin = pos;
+        // memchr is the vectorized scan of glibc
+        const char *eol = (const char*) memchr(data + begin, '\n', fileSize - begin);
+        size_t end = ( eol ? eol - data : fileSize );
+        pos = ( eol ? end + 1 : fileSize );
+        data[end] = '\0';
+        if( end > begin && data[end-1] == '\r' ) data[--end] = '\0';
+        return end - begin;
+    }
+
+    // split the text into records up to the first malformed one
+    void index(size_t fileSize){
+        // four lines per record, 40 bytes is a fair guess for the shortest one
+        records.reserve( fileSize/40 );
+
+        size_t pos = 0;
+        while( pos < fileSize ){
+            Record rec;
+            rec.identifier       = pos;
+            rec.identifierLength = nextLine(pos, fileSize);
+            rec.sequence         = pos;
+            rec.sequenceLength   = nextLine(pos, fileSize);
+            size_t separator     = pos;
+            nextLine(pos, fileSize);
+            rec.quality          = pos;
+            rec.qualityLength    = nextLine(pos, fileSize);
+
+            if( data[rec.identifier] != '@' || data[separator] != '+' ) break;
+            records.push_back(rec);
+        }
+        records.shrink_to_fit();
+    }
+
+    static unsigned littleEndian(const unsigned char *p, size_t nBytes){
+        unsigned value = 0;
+        for(size_t i=0; i<nBytes; i++) value |= unsigned(p[i])<<(8*i);
+        return value;
+    }
+
+    // size of the BGZF block starting at 'p' or 0 if it is not one
+    static size_t bgzfBlockSize(const unsigned char *p, size_t left){
+        if( left < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4) ) return 0;
+        size_t xlen = littleEndian(p+10, 2);
+        // look for the 'BC' subfield holding the block size
+        for(size_t pos=12; pos+4 <= 12+xlen && pos+4 <= left; ){
+            size_t slen = littleEndian(p+pos+2, 2);
+            if( p[pos] == 'B' && p[pos+1] == 'C' && slen == 2 && pos+6 <= left ){
+                size_t size = littleEndian(p+pos+4, 2) + 1;
+                return ( size <= left && size >= 12+xlen+8 ? size : 0 );
+            }
+            pos += 4 + slen;
+        }
+        return 0;
+    }
+
+    // inflate a raw deflate stream of known size, returns false on corrupted input
+    static bool inflateBlock(const unsigned char *in, size_t inSize, char *out, size_t outSize, unsigned crc){
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if( inflateInit2(&z, -15) != Z_OK ) return false;
+        z.next_in   = (Bytef*) in;
+        z.avail_in  = inSize;
+        z.next_out  = (Bytef*) out;
+        z.avail_out = outSize;
+        int status  = inflate(&z, Z_FINISH);
+        inflateEnd(&z);
+        return status == Z_STREAM_END && z.avail_out == 0 && crc32(0, (Bytef*) out, outSize) == crc;
+    }
+
+    // BGZF: locate the blocks and their places in the output first, then inflate them in parallel
+    bool inflateBGZF(const unsigned char *in, size_t inSize, size_t nThreads, size_t &outSize){
+        std::vector<size_t> inOffset, outOffset;
+        outSize = 0;
+        for(size_t pos=0; pos<inSize; ){
+            size_t size = bgzfBlockSize(in+pos, inSize-pos);
+            if( !size ) return false;
+            inOffset. push_back(pos);
+            outOffset.push_back(outSize);
+            outSize += littleEndian(in+pos+size-4, 4);
+            pos += size;
+        }
+        inOffset. push_back(inSize);
+        outOffset.push_back(outSize);
+
+        data = (char*) malloc(outSize + 1);
+        if( !data ) return false;
+        data[outSize] = '\0';
+
+        std::atomic<bool> good(true);
+        {
+            ThreadPool pool(nThreads);
+            // a few hundred kB of output per task
+            const size_t blocksInTask = 8;
+            for(size_t first=0; first+1<inOffset.size(); first+=blocksInTask)
+                pool.submit( [&,first]{
+                    for(size_t b=first; b<first+blocksInTask && b+1<inOffset.size(); b++){
+                        const unsigned char *block = in + inOffset[b];
+                        size_t blockSize = inOffset[b+1] - inOffset[b];
+                        size_t header    = 12 + littleEndian(block+10, 2);
+                        if( !inflateBlock(block + header, blockSize - header - 8,
+                                          data + outOffset[b], outOffset[b+1] - outOffset[b],
+                                          littleEndian(block+blockSize-8, 4)) ) good = false;
+                    }
+                } );
+            pool.wait();
+        }
+        return good;
+    }
+
+    // plain gzip (possibly several concatenated members) can only be inflated sequentially
+    bool inflateGzip(const unsigned char *in, size_t inSize, size_t &outSize){
+        size_t capacity = 4*inSize + 1024;
+        data = (char*) malloc(capacity);
+        if( !data ) return false;
+
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if( inflateInit2(&z, 15+16) != Z_OK ) return false;
+        z.next_in  = (Bytef*) in;
+        z.avail_in = inSize;
+        outSize = 0;
+        int status = Z_OK;
+        while( 1 ){
+            // keep one byte for the final terminator
+            if( capacity - outSize < 2 ){
+                char *bigger = (char*) realloc(data, 2*capacity);
+                if( !bigger ){ inflateEnd(&z); return false; }
+                data = bigger;
+                capacity *= 2;
+            }
+            z.next_out  = (Bytef*) data + outSize;
+            z.avail_out = capacity - outSize - 1;
+            status = inflate(&z, Z_NO_FLUSH);
+            outSize = capacity - 1 - z.avail_out;
+            if( status == Z_STREAM_END ){
+                if( z.avail_in == 0 ) break;
+                inflateReset(&z); // next member
+            } else if( status != Z_OK && status != Z_BUF_ERROR ) break;
+            else if( status == Z_BUF_ERROR && z.avail_in == 0 ) break; // truncated file
+        }
+        inflateEnd(&z);
+        data[outSize] = '\0';
+        return status == Z_STREAM_END;
+    }
+
+public:
+    size_t size(void) const { return records.size(); }
+
+    FastqField identifier(size_t read) const { return FastqField(data + records[read].identifier, records[read].identifierLength); }
+    FastqField sequence  (size_t read) const { return FastqField(data + records[read].sequence,   records[read].sequenceLength);   }
+    FastqField quality   (size_t read) const { return FastqField(data + records[read].quality,    records[read].qualityLength);    }
+
+    // returns -1 if the file cannot be read; 'nThreads' inflate BGZF input
+    int open(const char *fileName, size_t nThreads = std::thread::hardware_concurrency()){
+        int fd = ::open(fileName, O_RDONLY);
+        if( fd < 0 ){ std::cerr<<"Cannot open "<<fileName<<std::endl; return -1; }
+
+        struct stat st;
+        if( fstat(fd, &st) ){ std::cerr<<"Cannot open "<<fileName<<std::endl; ::close(fd); return -1; }
+        size_t fileSize = st.st_size;
+
+        unsigned char magic[2] = {0,0};
+        if( fileSize >= 2 && pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b ){
+            const unsigned char *in = (const unsigned char*) mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if( in == MAP_FAILED ){ std::cerr<<"Cannot map "<<fileName<<std::endl; return -1; }
+            madvise((void*)in, fileSize, MADV_SEQUENTIAL);
+
+            size_t textSize = 0;
+            bool good = ( bgzfBlockSize(in, fileSize) ? inflateBGZF(in, fileSize, nThreads, textSize)
+                                                      : inflateGzip(in, fileSize, textSize) );
+            munmap((void*)in, fileSize);
+            if( !good ){ std::cerr<<"Cannot decompress "<<fileName<<std::endl; return -1; }
+
+            index(textSize);
+            return 0;
+        }
+
+        // one extra zero byte (from an anonymous page if the file ends on a page boundary)
+        //  terminates the last line when the file lacks the final newline
+        mapped = fileSize + 1;
+        data = (char*) mmap(NULL, mapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if( data == MAP_FAILED ){ std::cerr<<"Cannot map "<<fileName<<std::endl; ::close(fd); data = 0; mapped = 0; return -1; }
+        if( fileSize && mmap(data, fileSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED ){
+            std::cerr<<"Cannot map "<<fileName<<std::endl;
+            ::close(fd);
+            return -1;
+        }
+        ::close(fd);
+
+        madvise(data, fileSize, MADV_SEQUENTIAL);
+        index(fileSize);
+        madvise(data, fileSize, MADV_NORMAL);
+        return 0;
+    }
+
+    FastqFile(void):data(0),mapped(0){}
+    ~FastqFile(void){
+        if( !data ) return;
+        if( mapped ) munmap(data, mapped); else free(data);
+    }
+};
+
+// Records read one after another through zlib (which passes plain files through unchanged),
+//  so only a window of the file is in memory; the fields of a record stay valid until the next call
+class FastqStream {
+private:
+    gzFile            file;
+    std::vector<char> buffer;
+    size_t begin, end;      // unread part of the buffer
+    bool   done;
+    const char *field[3];   // identifier, sequence and quality of the current record
+    size_t      length[3];
+
+    // move the unread part to the beginning of the buffer and append the next piece of the file;
+    //  one spare byte is always kept after 'end'
+    bool refill(void){
+        if( done ) return false;
+        if( begin ){
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end  -= begin;
+            begin = 0;
+        }
+        if( buffer.size() - end < buffer.size()/2 ) buffer.resize( 2*buffer.size() );
+        int n = gzread(file, buffer.data() + end, buffer.size() - end - 1);
+        if( n <= 0 ){ done = true; return false; }
+        end += n;
+        return true;
+    }
+
+public:
+    FastqField identifier(void) const { return FastqField(field[0], length[0]); }
+    FastqField sequence  (void) const { return FastqField(field[1], length[1]); }
+    FastqField quality   (void) const { return FastqField(field[2], length[2]); }
+
+    // advance to the next record; false at the end of the file or at a malformed record
+    bool next(void){
+        size_t line[4], len[4];
+        size_t rel = 0; // lines are kept relative to 'begin' as refill moves the data
+        for(int l=0; l<4; l++){
+            const char *eol;
+            while( (eol = (const char*) memchr(buffer.data() + begin + rel, '\n', end - begin - rel)) == 0 ){
+                if( refill() ) continue;
+                if( begin + rel == end ) return false;
+                buffer[end++] = '\n'; // the last line lacks the final newline
+            }
+            line[l] = rel;
+            len [l] = eol - (buffer.data() + begin) - rel;
+            rel    += len[l] + 1;
+        }
+
+        char *record = buffer.data() + begin;
+        for(int l=0; l<4; l++){
+            record[ line[l] + len[l] ] = '\0';
+            if( len[l] && record[ line[l] + len[l] - 1 ] == '\r' ) record[ line[l] + --len[l] ] = '\0';
+        }
+        if( record[line[0]] != '@' || record[line[2]] != '+' ) return false;
+
+        field[0] = record + line[0]; length[0] = len[0];
+        field[1] = record + line[1]; length[1] = len[1];
+        field[2] = record + line[3]; length[2] = len[3];
+        begin += rel;
+        return true;
+    }
+
+    // returns -1 if the file cannot be opened
+    int open(const char *fileName){
+        file = gzopen(fileName, "rb");
+        if( !file ){ std::cerr<<"Cannot open "<<fileName<<std::endl; return -1; }
+        gzbuffer(file, 1<<20);
+        buffer.resize(1<<22);
+        begin = end = 0;
+        done  = false;
+        return 0;
+    }
+
+    FastqStream(void):file(0),begin(0),end(0),done(true){}
+    ~FastqStream(void){ if( file ) gzclose(file); }
+};
+
+// Records are collected in a large buffer that goes to the file (compressed by zlib on request) only
+//  when full; given a thread pool, a worker writes the full buffer out while the next one fills up
+class FastqWriter {
+private:
+    int         fd;
+    gzFile      gz;
+    ThreadPool *pool;
+    std::vector<char> buffer, spare;
+    size_t used;
+
+    std::mutex              mtx;
+    std::condition_variable idle;
+    bool writing;  // 'spare' is being written by a worker
+    bool good;
+
+    void dump(const std::vector<char> &buf, size_t size){
+        if( gz ){
+            if( size && gzwrite(gz, buf.data(), size) != int(size) ) good = false;
+            return;
+        }
+        for(size_t done=0; done<size; ){
+            ssize_t n = ::write(fd, buf.data() + done, size - done);
+            if( n <= 0 ){ good = false; return; }
+            done += n;
+        }
+    }
+
+    void waitIdle(void){
+        std::unique_lock<std::mutex> lock(mtx);
+        idle.wait(lock, [this]{ return !writing; });
+    }
+
+    void flush(void){
+        waitIdle();
+        if( !pool ){ dump(buffer, used); used = 0; return; }
+
+        buffer.swap(spare);
+        size_t size = used;
+        used = 0;
+        { std::lock_guard<std::mutex> lock(mtx); writing = true; }
+        pool->submit( [this,size]{
+            dump(spare, size);
+            std::lock_guard<std::mutex> lock(mtx);
+            writing = false;
+            idle.notify_all();
+        } );
+    }
+
+    void append(const char *ptr, size_t length){
+        if( used + length > buffer.size() ){
+            flush();
+            if( length > buffer.size() ) buffer.resize(length);
+        }
+        memcpy(buffer.data() + used, ptr, length);
+        used += length;
+    }
+
+public:
+    void write(const FastqField &identifier, const FastqField &sequence, const FastqField &quality){
+        append(identifier.c_str(), identifier.length()); append("\n",   1);
+        append(sequence.  c_str(), sequence.  length()); append("\n+\n", 3);
+        append(quality.   c_str(), quality.   length()); append("\n",   1);
+    }
+
+    // returns -1 if the file cannot be created
+    int open(const char *fileName, bool compress = false, ThreadPool *writers = 0, size_t bufferSize = 1<<20){
+        fd = ::open(fileName, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if( fd < 0 ){ std::cerr<<"Cannot open "<<fileName<<std::endl; return -1; }
+        if( compress ){
+            // the fastest level: the output is meant for the next step of the analysis, not for archiving
+            gz = gzdopen(fd, "wb1");
+            if( !gz ){ std::cerr<<"Cannot open "<<fileName<<std::endl; ::close(fd); fd = -1; return -1; }
+        }
+        pool = writers;
+        buffer.resize(bufferSize);
+        if( pool ) spare.resize(bufferSize);
+        used    = 0;
+        writing = false;
+        good    = true;
+        return 0;
+    }
+
+    // returns -1 if any of the writes failed
+    int close(void){
+        if( fd < 0 ) return 0;
+        waitIdle();
+        dump(buffer, used);
+        used = 0;
+        if( gz ){ if( gzclose(gz) != Z_OK ) good = false; } // closes 'fd' as well
+        else ::close(fd);
+        gz = 0;
+        fd = -1;
+        return good ? 0 : -1;
+    }
+
+    FastqWriter(void):fd(-1),gz(0),pool(0),used(0),writing(false),good(true){}
+    ~FastqWriter(void){ close(); }
+};
+///////////////////////////////////////////////////////////////////////
+
+#endif
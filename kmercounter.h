@@ -0,0 +1,256 @@
+#ifndef KMERCOUNTER_H
+#define KMERCOUNTER_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include "./threadpool.h"
+
+////////////////////// k-mer counter //////////////////////
+
+// Occurrences of the k-mers packed in 2 bits per symbol. Short k-mers index an array of 4^k counters
+//  directly, as long as the array stays small (DIRECT_MAX_COUNTERS) or comparable to the expected
+//  number of distinct k-mers: real reads scatter over nearly every page of a larger array and the
+//  sorted dump walks all of it. Other k-mers go to an open-addressed table (linear probing, at most
+//  half full) where a zero count marks an empty slot
+class KmerCounter {
+public:
+    static const unsigned long long DIRECT_MAX_COUNTERS = 1ULL<<24;
+    typedef std::pair<unsigned long long, unsigned int> Entry; // k-mer and its count
+
+private:
+    size_t        k;
+    unsigned int *direct;                 // 4^k counters or 0
+    std::vector<unsigned long long> keys; // open addressing
+    std::vector<unsigned int>       hits;
+    size_t nDistinct;
+    int    shift;                         // 64 - log2(size of the table)
+
+    size_t slot(unsigned long long kmer) const {
+        // Fibonacci hashing spreads the low-entropy packed k-mers over the table
+        return (kmer * 0x9E3779B97F4A7C15ULL) >> shift;
+    }
+
+    void grow(void){
+        std::vector<unsigned long long> oldKeys;
+        std::vector<unsigned int>       oldHits;
+        oldKeys.swap(keys);
+        oldHits.swap(hits);
+        shift--;
+        keys.resize(oldKeys.size()*2);
+        hits.resize(oldHits.size()*2, 0);
+        for(size_t i=0; i<oldKeys.size(); i++){
+            if( !oldHits[i] ) continue;
+            size_t s = slot(oldKeys[i]);
+            while( hits[s] ) s = (s + 1) & (keys.size() - 1);
+            keys[s] = oldKeys[i];
+            hits[s] = oldHits[i];
+        }
+    }
+
+public:
+    void add(unsigned long long kmer, unsigned int n = 1){
+        if( direct ){
+            nDistinct += ( direct[kmer] == 0 );
+            direct[kmer] += n;
+            return;
+        }
+        size_t s = slot(kmer);
+        while( hits[s] && keys[s] != kmer ) s = (s + 1) & (keys.size() - 1);
+        if( !hits[s] ){
+            keys[s] = kmer;
+            if( 2*(++nDistinct) > keys.size() ){
+                hits[s] = n;
+                grow();
+                return;
+            }
+        }
+        hits[s] += n;
+    }
+
+    unsigned int count(unsigned long long kmer) const {
+        if( direct ) return direct[kmer];
+        for(size_t s = slot(kmer); hits[s]; s = (s + 1) & (keys.size() - 1))
+            if( keys[s] == kmer ) return hits[s];
+        return 0;
+    }
+
+    // number of distinct k-mers
+    size_t size(void) const { return nDistinct; }
+
+    size_t length(void) const { return k; }
+
+    // all counted k-mers in increasing order of their packed values
+    void sorted(std::vector<Entry> &entries) const {
+        entries.clear();
+        entries.reserve(nDistinct);
+        if( direct ){
+            for(unsigned long long kmer=0; kmer < (1ULL<<(2*k)); kmer++)
+                if( direct[kmer] ) entries.push_back( Entry(kmer, direct[kmer]) );
+            return;
+        }
+        for(size_t s=0; s<keys.size(); s++)
+            if( hits[s] ) entries.push_back( Entry(keys[s], hits[s]) );
+        std::sort(entries.begin(), entries.end());
+    }
+
+    // add up the counts of another counter of the same k
+    void merge(const KmerCounter &other){
+        std::vector<Entry> entries;
+        other.sorted(entries);
+        for(size_t i=0; i<entries.size(); i++) add(entries[i].first, entries[i].second);
+    }
+
+    // is the direct array worth it for k-mers of 'length' symbols
+    static bool directFits(size_t length, size_t expected = 1024){
+        if( length >= 32 ) return false;
+        unsigned long long counters = 1ULL<<(2*length);
+        return counters <= DIRECT_MAX_COUNTERS || counters <= 4*(unsigned long long)expected;
+    }
+
+    // 'expected' is a hint for the number of distinct k-mers
+    KmerCounter(size_t length, size_t expected = 1024):KmerCounter(length, expected, directFits(length, expected)){}
+
+    // the storage imposed, e.g. for a partition of longer k-mers
+    KmerCounter(size_t length, size_t expected, bool directArray):k(length),direct(0),nDistinct(0),shift(64){
+        if( directArray ){
+            direct = (unsigned int*) calloc(1ULL<<(2*k), sizeof(unsigned int));
+            if( direct ) return;
+        }
+        size_t size = 2;
+        while( size < 2*expected ) size *= 2;
+        for(size_t s=size; s>1; s>>=1) shift--;
+        keys.resize(size);
+        hits.resize(size, 0);
+    }
+    ~KmerCounter(void){ free(direct); }
+
+private:
+    // the counters own the calloc'ed array
+    KmerCounter(const KmerCounter&);
+    KmerCounter& operator=(const KmerCounter&);
+};
+
+// The same counts gathered by many threads. A k-mer goes to one of 4^prefix partitions by its highest
+//  'prefix' symbols, so a partition counts the remaining symbols only and the partitions taken in turn
+//  give all k-mers in order. Every thread buffers its k-mers per partition and flushes a full buffer
+//  holding the lock of that partition only. With a spill directory the buffers are appended to a
+//  temporary file per partition and the partitions are counted at the end, a few at a time, so only
+//  those few tables are in memory at once
+class PartitionedKmerCounter {
+public:
+    typedef KmerCounter::Entry Entry;
+
+    // k-mers of one thread waiting to be flushed into the partitions
+    class Buffer {
+        friend class PartitionedKmerCounter;
+        std::vector< std::vector<unsigned long long> > parts;
+    };
+
+private:
+    static const size_t BUFFER_SIZE = 4096;
+
+    size_t k, prefix, suffix;             // suffix = k - prefix symbols are counted in a partition
+    bool   direct;                        // the storage is chosen for the whole k-mers, not for the suffixes
+    std::vector< std::unique_ptr<KmerCounter> > tables;
+    std::vector< std::unique_ptr<std::mutex> >  locks;
+    std::vector< FILE* >                        spills;
+
+    unsigned long long suffixMask(void) const { return ( suffix < 32 ? (1ULL<<(2*suffix)) - 1 : ~0ULL ); }
+
+    void flush(size_t part, std::vector<unsigned long long> &buffer){
+        std::lock_guard<std::mutex> lock(*locks[part]);
+        if( spills[part] ) fwrite(buffer.data(), sizeof(unsigned long long), buffer.size(), spills[part]);
+        else for(size_t i=0; i<buffer.size(); i++) tables[part]->add(buffer[i]);
+        buffer.clear();
+    }
+
+    // counts of one partition in order, the table (or the spill file) is released
+    void count(size_t part, std::vector<Entry> &entries){
+        if( spills[part] ){
+            KmerCounter table(suffix, 1024, direct);
+            std::vector<unsigned long long> chunk(1<<16);
+            rewind(spills[part]);
+            for(size_t n; (n = fread(chunk.data(), sizeof(unsigned long long), chunk.size(), spills[part])) > 0; )
+                for(size_t i=0; i<n; i++) table.add(chunk[i]);
+            fclose(spills[part]);
+            spills[part] = 0;
+            table.sorted(entries);
+        } else {
+            tables[part]->sorted(entries);
+            tables[part].reset();
+        }
+        unsigned long long high = ( suffix < 32 ? (unsigned long long)part << (2*suffix) : 0 );
+        for(size_t i=0; i<entries.size(); i++) entries[i].first |= high;
+    }
+
+public:
+    void add(Buffer &buffer, unsigned long long kmer){
+        if( buffer.parts.empty() ) buffer.parts.resize(tables.size());
+        size_t part = ( suffix < 32 ? kmer >> (2*suffix) : 0 );
+        std::vector<unsigned long long> &b = buffer.parts[part];
+        b.push_back( kmer & suffixMask() );
+        if( b.size() >= BUFFER_SIZE ) flush(part, b);
+    }
+
+    // call once a thread is done with its buffer
+    void flush(Buffer &buffer){
+        for(size_t part=0; part<buffer.parts.size(); part++)
+            if( !buffer.parts[part].empty() ) flush(part, buffer.parts[part]);
+    }
+
+    // hands the sorted counts of every partition in turn over to 'output' (all buffers must be
+    //  flushed); the pool counts as many partitions at a time as it has threads
+    void dump(ThreadPool &pool, std::function<void(const std::vector<Entry>&)> output){
+        std::vector< std::vector<Entry> > batch(pool.size());
+        for(size_t first=0; first<tables.size(); first+=batch.size()){
+            size_t last = std::min(first + batch.size(), tables.size());
+            for(size_t part=first; part<last; part++)
+                pool.submit( [this,part,first,&batch]{ count(part, batch[part-first]); } );
+            pool.wait();
+            for(size_t part=first; part<last; part++){
+                output(batch[part-first]);
+                std::vector<Entry>().swap(batch[part-first]);
+            }
+        }
+    }
+
+    // returns false if the spill files cannot be created
+    bool spill(const char *directory){
+        for(size_t part=0; part<spills.size(); part++){
+            std::string name = std::string(directory) + "/kmersXXXXXX";
+            int fd = mkstemp(&name[0]);
+            if( fd < 0 || !(spills[part] = fdopen(fd, "w+")) ) return false;
+            unlink(name.c_str()); // removed once closed
+            tables[part].reset();
+        }
+        return true;
+    }
+
+    // 'prefix' is reduced to leave at least one symbol in a partition
+    PartitionedKmerCounter(size_t length, size_t prefixSymbols = 3):k(length),prefix(prefixSymbols){
+        if( prefix >= k ) prefix = ( k ? k - 1 : 0 );
+        suffix = k - prefix;
+        // the direct arrays of all partitions together hold 4^k counters
+        direct = KmerCounter::directFits(k);
+        size_t nParts = 1ULL<<(2*prefix);
+        for(size_t part=0; part<nParts; part++){
+            tables.push_back( std::unique_ptr<KmerCounter>( new KmerCounter(suffix, 1024, direct) ) );
+            locks. push_back( std::unique_ptr<std::mutex> ( new std::mutex ) );
+            spills.push_back( 0 );
+        }
+    }
+    ~PartitionedKmerCounter(void){
+        for(size_t part=0; part<spills.size(); part++) if( spills[part] ) fclose(spills[part]);
+    }
+};
+///////////////////////////////////////////////////////////////////////
+
+#endif
@@ -11,18 +11,16 @@
 
 #include "./toolbox.h"
 #include "./alignment.cc"
+#include "./fastq.h"
 
 const char *fileName = "./testReads.fastq";
 
-#define NREC (10000)
 size_t nReads = 0;
 
-// g++ -g -Wall -std=c++0x -o q overlaps.cc -lpthread
+// g++ -g -Wall -std=c++0x -o q overlaps.cc -lpthread -lz
 
 using namespace std;
-vector<string> identifier(NREC);
-vector<string> sequence  (NREC);
-vector<string> quality   (NREC);
+FastqFile fastq;
 
 /////////////////// multithreaded calculations /////////////////
 const size_t viewWidth = 31;
@@ -55,7 +53,7 @@ static void* findMatches(void *arg){
         // init the map
         similars[read1].clear();
 
-        const char *seq1 = sequence[read1].c_str();
+        const char *seq1 = fastq.sequence(read1).c_str();
 
         // break the read into patterns of viewWidth size
         char matchPattern[MAX_ADAPTORS][MAX_LENGTH];
@@ -70,24 +68,10 @@ static void* findMatches(void *arg){
 
             // build the hash from the patterns
             LookUpTable lookUp(matchPattern);
-            // check quality of the hash table
-            size_t maxCollisions = 0;
-            lookUp.countCollisions( maxCollisions );
-            if( maxCollisions >= MAX_COLLISIONS ){
-                for(size_t k=0; k<MAX_ADAPTORS; k++){
-                    size_t length = strlen( matchPattern[k] );
-                    if( length > 0 ){
-                        unsigned short errorPos = 0;
-                        unsigned long long coreCode = sequence2number(matchPattern[k],strlen(matchPattern[k]),errorPos);
-                        printf("%ld: %s, bucket: %lld\n",k,matchPattern[k],coreCode % BUCKETS);
-                    }
-                }
-                return arg;
-            }
 
             // look for other reads matching any of the patterns of the reference record
             for(size_t read2=read1+1; read2<nReads; read2++){
-                const char *seq2 = sequence[read2].c_str();
+                const char *seq2 = fastq.sequence(read2).c_str();
 
                 NumericSequence numSeq(seq2);
                 for(size_t i=0; i<strlen(seq2)-viewWidth; i++){
@@ -124,14 +108,14 @@ static void* lookCloser(void *arg){
         if( !output ){ cout<<"Cannot open "<<fname<<endl; return 0; }
         output<<"read1,read2,score,len1,len2,overlap,overlapScore"<<endl;
 
-        const char *seq1 = sequence[read1].c_str();
+        const char *seq1 = fastq.sequence(read1).c_str();
 
         set<size_t> &candidates = similars[read1];
         for(set<size_t>::const_iterator it=candidates.begin(); it!=candidates.end(); it++){
 
             size_t read2 = *it;
 
-            const char *seq2 = sequence[read2].c_str();
+            const char *seq2 = fastq.sequence(read2).c_str();
 
             size_t len1 = strlen(seq1);
             size_t len2 = strlen(seq2);
@@ -171,32 +155,9 @@ int main(int argc, char *argv[]){
     size_t iteration = atol(argv[1]);
     const size_t nCycles = 100;
 
-    ifstream input(fileName);
-
-    if(!input){ cout<<"Cannot open "<<fileName<<endl; return 0; }
-
-    while( !input.eof() ){
-
-        if( nReads == identifier.size() ){
-            identifier.resize( identifier.size() + NREC );
-            sequence.  resize( sequence.  size() + NREC );
-            quality.   resize( quality.   size() + NREC );
-        }
-
-        string tmp;
-        getline(input, identifier[nReads], '\n' );
-        getline(input, sequence  [nReads], '\n' );
-        getline(input, tmp,                '\n' );
-        getline(input, quality   [nReads], '\n' );
-
-        if( identifier[nReads][0] != '@' || tmp[0] != '+') break;
-        nReads++;
-    }
-    input.close();
-
-    identifier.resize(nReads);
-    sequence.  resize(nReads);
-    quality.   resize(nReads);
+    // map the input file and index the records
+    if( fastq.open(fileName) ) return 0;
+    nReads = fastq.size();
 
     cout<<"Reads: "<<nReads<<endl;
 
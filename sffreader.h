@@ -0,0 +1,135 @@
+#ifndef SFFREADER_H
+#define SFFREADER_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+////////////////////// zero-copy SFF reader //////////////////////
+
+// One record of SFF (the binary format of 454 and Ion Torrent reads) seen through the mapped file;
+//  bases and quality are not NUL-terminated and the quality holds Phred scores without an offset
+struct SffRecord {
+    const char          *raw;       // the whole record with its header, data and padding
+    size_t               rawLength;
+    const char          *name;
+    size_t               nameLength;
+    const char          *bases;
+    const unsigned char *quality;
+    size_t               nBases;
+    size_t               clipLeft, clipRight; // the part [clipLeft, clipRight) kept after trimming
+
+    const char*          clippedBases  (void) const { return bases   + clipLeft; }
+    const unsigned char* clippedQuality(void) const { return quality + clipLeft; }
+    size_t               clippedLength (void) const { return clipRight - clipLeft; }
+};
+
+// The file is mapped read-only and only the offsets of the records are kept: nothing is allocated
+//  or copied per record, and records can be visited in any order (e.g. in ranges by many threads)
+class SffFile {
+private:
+    const char *data;
+    size_t      fileSize;
+    size_t      headerLength;
+    unsigned    nFlows;
+    std::vector<size_t> offsets;
+
+    static uint16_t be16(const char *p){ uint16_t v; memcpy(&v, p, sizeof(v)); return be16toh(v); }
+    static uint32_t be32(const char *p){ uint32_t v; memcpy(&v, p, sizeof(v)); return be32toh(v); }
+    static uint64_t be64(const char *p){ uint64_t v; memcpy(&v, p, sizeof(v)); return be64toh(v); }
+
+    static size_t pad8(size_t length){ return (length + 7) & ~size_t(7); }
+
+    // walk the records by their padded header and data lengths skipping the index wherever it is;
+    //  returns false if the file ends before 'nReads' records
+    bool index(size_t nReads, size_t indexOffset, size_t indexLength){
+        offsets.reserve(nReads);
+        size_t pos = headerLength;
+        while( offsets.size() < nReads ){
+            if( indexLength && pos == indexOffset ) pos += pad8(indexLength);
+            if( pos + 16 > fileSize ) return false;
+            size_t length = recordLength(pos);
+            if( length < 16 || pos + length > fileSize ) return false;
+            offsets.push_back(pos);
+            pos += length;
+        }
+        return true;
+    }
+
+    size_t recordLength(size_t pos) const {
+        return be16(data+pos) + pad8( 2*nFlows + 3*size_t(be32(data+pos+4)) );
+    }
+
+public:
+    size_t size(void) const { return offsets.size(); }
+
+    // the raw common header to start a new file with
+    const char* commonHeader      (void) const { return data; }
+    size_t      commonHeaderLength(void) const { return headerLength; }
+
+    SffRecord record(size_t read) const {
+        const char *p = data + offsets[read];
+        SffRecord rec;
+        size_t readHeaderLength = be16(p);
+        rec.raw        = p;
+        rec.rawLength  = recordLength(offsets[read]);
+        rec.nameLength = be16(p+2);
+        rec.name       = p + 16;
+        rec.nBases     = be32(p+4);
+        // data: flowgram values, flow indices, bases and quality scores
+        const char *d  = p + readHeaderLength;
+        rec.bases      = d + 2*nFlows + rec.nBases;
+        rec.quality    = (const unsigned char*) rec.bases + rec.nBases;
+
+        // clipping points are 1-based and 0 stands for 'not set' (the rules of sff2fastq)
+        size_t qualLeft  = be16(p+8),  qualRight  = be16(p+10);
+        size_t adaptLeft = be16(p+12), adaptRight = be16(p+14);
+        size_t left  = std::max(size_t(1), std::max(qualLeft, adaptLeft)) - 1;
+        size_t right = std::min( qualRight  ? qualRight  : rec.nBases,
+                                 adaptRight ? adaptRight : rec.nBases );
+        rec.clipRight = std::min(right, rec.nBases);
+        rec.clipLeft  = std::min(left,  rec.clipRight);
+        return rec;
+    }
+
+    // returns -1 if the file cannot be read or is not SFF
+    int open(const char *fileName){
+        int fd = ::open(fileName, O_RDONLY);
+        if( fd < 0 ){ std::cerr<<"Cannot open "<<fileName<<std::endl; return -1; }
+
+        struct stat st;
+        if( fstat(fd, &st) ){ std::cerr<<"Cannot open "<<fileName<<std::endl; ::close(fd); return -1; }
+        fileSize = st.st_size;
+
+        if( fileSize < 31 ){ std::cerr<<fileName<<" is not an SFF file"<<std::endl; ::close(fd); return -1; }
+        data = (const char*) mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if( data == MAP_FAILED ){ std::cerr<<"Cannot map "<<fileName<<std::endl; data = 0; return -1; }
+
+        // common header: magic ".sff", version 1, index offset and length, number of reads,
+        //  header length, key length, number of flows and flowgram format 1
+        const char version[4] = {0,0,0,1};
+        headerLength = be16(data+24);
+        nFlows       = be16(data+28);
+        if( be32(data) != 0x2E736666 || memcmp(data+4, version, 4) || data[30] != 1 || headerLength > fileSize ){
+            std::cerr<<fileName<<" is not an SFF file"<<std::endl;
+            return -1;
+        }
+        size_t nReads = be32(data+20);
+        if( !index(nReads, be64(data+8), be32(data+16)) )
+            std::cerr<<"Warning: "<<fileName<<" is truncated after "<<offsets.size()<<" of "<<nReads<<" reads"<<std::endl;
+        return 0;
+    }
+
+    SffFile(void):data(0),fileSize(0),headerLength(0),nFlows(0){}
+    ~SffFile(void){ if( data ) munmap((void*)data, fileSize); }
+};
+///////////////////////////////////////////////////////////////////////
+
+#endif
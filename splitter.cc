@@ -1,12 +1,49 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string>
 #include "./toolbox.h"
+#include "./sffreader.h"
+#include "./threadpool.h"
+#include "./fastq.h"
 
-// Input file names
+// Input file names and the directory for the outputs (created if needed), so that several
+//  jobs can run side by side
 const char *inputFileName   = "input.sff";
 const char *adaptorFileName = "ionXpress_barcode.txt";
-
+const char *outputDir       = ".";
+
+// Number of substitutions tolerated in a barcode (0 keeps the exact matching)
+size_t maxMismatches = 0;
+
+// Every read goes to a single adaptor: the closest (then longest, then leftmost) occurrence of an
+//  adaptor starting within the first 'searchWindow' bases (0 for the whole read). Barcodes sit at
+//  the 5' end, elsewhere a match is likely random and only costs time, hence the narrow default.
+//  Optionally, a read without a barcode there is searched for one ending within its last
+//  'searchWindow' bases, and reverse complements of the barcodes are looked for as well
+AdaptorScanner::Policy policy = AdaptorScanner::BEST_HIT;
+size_t searchWindow = 8;
+bool   searchTail   = false;
+bool   bothStrands  = false;
+
+// Number of threads assigning the reads and writing the outputs (hardware_concurrency may not know)
+size_t nThreads = std::max(1U, std::thread::hardware_concurrency());
+
+// Outputs (sff, fastq or split): the records of every adaptor copied to its own
+//  SFF file, all reads converted to a single FASTQ file (as sff2fastq does), or a FASTQ file per
+//  adaptor; the latter keeps the clipped bases following the barcode if 'trimBarcodes' is set
+enum OutputFormat { SFF, FASTQ, SPLIT_FASTQ };
+OutputFormat format = SFF;
+bool trimBarcodes = true;
+
+
+// <outputDir>/<name><extension>
+std::string outputName(const char *name, const char *extension){
+    return std::string(outputDir) + "/" + name + extension;
+}
 
 // Read specified text file with adaptors' names and coding sequences separated by tabs
 unsigned int readAdaptors(const char *fileName, char names[MAX_ADAPTORS][MAX_LENGTH], char bases[MAX_ADAPTORS][MAX_LENGTH]){
@@ -37,11 +74,167 @@ unsigned int readAdaptors(const char *fileName, char names[MAX_ADAPTORS][MAX_LEN
 #include <endian.h>
 #include <stdint.h>
 
-int   readSFFcommonHeader(FILE *sff_fp);
-char* readSFFrecord(FILE *sff_fp);
+// Output of one adaptor: its own task copies the records once the whole input is assigned, going
+//  through the ranges in input order, and the number of reads in the copy of the common header is
+//  patched when the file is closed
+struct SffWriter {
+    FILE        *file;
+    unsigned int nReads;
+};
+
+#define WRITE_BUFFER (1<<18)
+
+// What is left of a clipped read when its barcode is cut off
+struct Insert {
+    unsigned short begin, end;
+};
+
+// Reads of one range of the input by the adaptors (MAX_ADAPTORS collects the reads without barcode);
+//  the lists of consecutive ranges put together keep the order of the input
+struct Assignment {
+    std::vector<unsigned int> reads  [MAX_ADAPTORS+1];
+    std::vector<Insert>       inserts[MAX_ADAPTORS+1];
+    unsigned int nAmbiguous;
+    Assignment(void):nAmbiguous(0){}
+};
+
+#define READS_PER_TASK (1<<14)
+
+void openSffWriter(SffWriter *writer, const char *name, const char *header, size_t headerLength){
+    if( (writer->file = fopen(name,"w")) == NULL ){
+        printf("Cannot open %s\n", name);
+        exit(0);
+    }
+    setvbuf(writer->file, NULL, _IOFBF, WRITE_BUFFER);
+    fwrite(header, headerLength, 1, writer->file);
+    writer->nReads = 0;
+}
+
+void closeSffWriter(SffWriter *writer){
+    if( !writer->file ) return;
+    uint32_t newNreads = htobe32( writer->nReads );
+    fseek (writer->file, 20, SEEK_SET);
+    fwrite(&newNreads, sizeof(uint32_t), 1, writer->file);
+    fclose(writer->file);
+    writer->file = NULL;
+}
+
+// Clipped bases of the record in [from, to) with their Phred scores shifted by 33 (the Sanger
+//  encoding); 'line' is a scratch buffer for the identifier and the quality line
+void writeFastq(FastqWriter &writer, const SffRecord &record, size_t from, size_t to, std::vector<char> &line){
+    size_t length = to - from;
+    line.resize(1 + record.nameLength + length);
+    line[0] = '@';
+    memcpy(line.data() + 1, record.name, record.nameLength);
+    char *quality = line.data() + 1 + record.nameLength;
+    const unsigned char *scores = record.clippedQuality() + from;
+    for(size_t i=0; i<length; i++) quality[i] = char( std::min(scores[i], (unsigned char)93) + 33 );
+    writer.write( FastqField(line.data(), 1 + record.nameLength),
+                  FastqField(record.clippedBases() + from, length),
+                  FastqField(quality, length) );
+}
 
 int main(int argc, char *argv[]){
 
+    // parse the options
+    static struct option options[] = {
+       {"help",         0, 0, 'h'},
+       {"input",        1, 0, 'i'},
+       {"barcodes",     1, 0, 'b'},
+       {"output",       1, 0, 'o'},
+       {"cores",        1, 0, 'c'},
+       {"mismatches",   1, 0, 'd'},
+       {"window",       1, 0, 'w'},
+       {"tail",         0, 0, 't'},
+       {"strands",      0, 0, 's'},
+       {"policy",       1, 0, 'p'},
+       {"format",       1, 0, 'f'},
+       {"keep",         0, 0, 'k'},
+       {0, 0, 0, 0}
+    };
+
+    printf("Running: ");
+    for(int arg=0; arg<argc; arg++) printf("%s ",argv[arg]);
+    printf("\n");
+
+    while( 1 ){
+       int index=0;
+       int c = getopt_long(argc, argv, "hi:b:o:c:d:w:tsp:f:k",options, &index);
+       if( c == -1 ) break;
+       switch( c ) {
+           case 'h':
+               printf("Usage:\n");
+               printf("-h     ,   --help              show this message\n");
+               printf("-i     ,   --input             SFF input file [default=input.sff]\n");
+               printf("-b     ,   --barcodes          Names and sequences of the barcodes separated by tabs [default=ionXpress_barcode.txt]\n");
+               printf("-o     ,   --output            Directory for the output files [default=.]\n");
+               printf("-c     ,   --cores             Number of CPU cores [default=all]\n");
+               printf("-d     ,   --mismatches        Number of mismatches tolerated in a barcode [default=0]\n");
+               printf("-w     ,   --window            Search window in the beginning of a read, 0 for the whole read [default=8]\n");
+               printf("-t     ,   --tail              Look for a barcode in the end of a read if there is none in the beginning\n");
+               printf("-s     ,   --strands           Look for reverse complements of the barcodes too\n");
+               printf("-p     ,   --policy            best (closest, longest, leftmost) or first (leftmost) barcode [default=best]\n");
+               printf("-f     ,   --format            Output: sff, fastq (all reads in one file) or split (FASTQ per barcode) [default=sff]\n");
+               printf("-k     ,   --keep              Keep the barcodes in the split FASTQ output\n");
+               return 0;
+           break;
+           case 'i':
+               inputFileName = optarg;
+           break;
+           case 'b':
+               adaptorFileName = optarg;
+           break;
+           case 'o':
+               outputDir = optarg;
+           break;
+           case 'c':
+               nThreads = strtoul(optarg,NULL,0);
+           break;
+           case 'd':
+               maxMismatches = strtoul(optarg,NULL,0);
+           break;
+           case 'w':
+               searchWindow = strtoul(optarg,NULL,0);
+           break;
+           case 't':
+               searchTail = true;
+           break;
+           case 's':
+               bothStrands = true;
+           break;
+           case 'p':
+               if(      !strcmp(optarg,"best")  ) policy = AdaptorScanner::BEST_HIT;
+               else if( !strcmp(optarg,"first") ) policy = AdaptorScanner::FIRST_HIT;
+               else {
+                   printf("Unknown policy %s (best or first)\n",optarg);
+                   return 0;
+               }
+           break;
+           case 'f':
+               if(      !strcmp(optarg,"sff")   ) format = SFF;
+               else if( !strcmp(optarg,"fastq") ) format = FASTQ;
+               else if( !strcmp(optarg,"split") ) format = SPLIT_FASTQ;
+               else {
+                   printf("Unknown output format %s (sff, fastq or split)\n",optarg);
+                   return 0;
+               }
+           break;
+           case 'k':
+               trimBarcodes = false;
+           break;
+           default : printf("Type -h for help\n"); return 0;
+       }
+    }
+
+    if( nThreads < 1 ){
+        printf("Number of cores (-c) should be at least 1\n");
+        return 1;
+    }
+    if( mkdir(outputDir, 0755) && errno != EEXIST ){
+        printf("Cannot create %s\n",outputDir);
+        return 0;
+    }
+
     // List of adaptors
     char adaptorNames[MAX_ADAPTORS][MAX_LENGTH];
     char adaptorBases[MAX_ADAPTORS][MAX_LENGTH];
@@ -52,185 +245,154 @@ int main(int argc, char *argv[]){
     size_t nAdaptors = readAdaptors(adaptorFileName,adaptorNames,adaptorBases);
     printf("nAdaptors = %ld\n",nAdaptors);
 
-    // Find longest and shortest adaptor lengths
-    size_t maxAdaptorLength = 0, minAdaptorLength = 1000000;
+    // Find longest adaptor length
+    size_t maxAdaptorLength = 0;
     for(size_t k=0; k<MAX_ADAPTORS; k++){
         size_t length = strlen( adaptorBases[k] );
-        if( length == 0 ) continue;
         if( length > maxAdaptorLength ) maxAdaptorLength = length;
-        if( length < minAdaptorLength ) minAdaptorLength = length;
     }
-    if( maxAdaptorLength - minAdaptorLength > 4 ){
-        printf("Adaptors should have length variation within 4 symbols max\n");
+    if( maxAdaptorLength > 32 ){
+        printf("Adaptors should not be longer than 32 symbols\n");
         return 0;
     }
 
-    // build a table
-    LookUpTable number2index(adaptorBases);
-    size_t maxCollisions = 0;
-    printf("Found %ld collisions\n",number2index.countCollisions(maxCollisions));
-    if( maxCollisions >= MAX_COLLISIONS ) exit(0); // do not tolerate broken LUT
-
-    // open input file:
-    FILE *inputFile = NULL;
-    if( (inputFile = fopen(inputFileName,"r")) == NULL ){
-        printf("Cannot open %s\n",inputFileName);
-        exit(0);
-    }
-
-    // make sure we remember where the common header is in the input file
-    long commonHeaderBegins = ftell(inputFile);
-    int nReads = readSFFcommonHeader(inputFile);
-    long commonHeaderLength = ftell(inputFile) - commonHeaderBegins;
-
-    printf("iterating over %d reads\n",nReads);
-
-    // every time we find an adaptor, we will remember the record position
-    unsigned int adaptorsFound[MAX_ADAPTORS+1];
-    long  *adaptorBegins[MAX_ADAPTORS+1]; //[nReads];
-    long  *adaptorLength[MAX_ADAPTORS+1]; //[nReads];
-    bzero(adaptorsFound, sizeof(adaptorsFound));
-    for(size_t a=0; a<MAX_ADAPTORS+1; a++){
-        adaptorBegins[a] = new long [nReads];
-        adaptorLength[a] = new long [nReads];
-        bzero(adaptorBegins[a], sizeof(long)*nReads);
-        bzero(adaptorLength[a], sizeof(long)*nReads);
-    }
-
-    for(size_t read=0; read<nReads; read++){
-
-        long recordBegins = ftell(inputFile);
-        char *seq = readSFFrecord(inputFile);
-        long recordLength = ftell(inputFile) - recordBegins;
-
-        NumericSequence numSeq(seq);
-        if( numSeq.error() ){
-            printf("Warning\n");
-        }
-
-        bool foundAdaptor = false;
-
-        if( strlen(seq) >= minAdaptorLength ){
-
-            for(size_t i=0; i<strlen(seq) - minAdaptorLength; i++){
-                unsigned long long view = numSeq.view(i,maxAdaptorLength);
-                size_t len = maxAdaptorLength;
-                size_t ind = number2index.find( view, len );
-                if( ind != MAX_ADAPTORS ){
-                    adaptorBegins[ind][ adaptorsFound[ind] ] = recordBegins;
-                    adaptorLength[ind][ adaptorsFound[ind] ] = recordLength;
-                    adaptorsFound[ind]++;
-                    foundAdaptor = true;
+    // compile the adaptors (and their Hamming neighbourhoods) into a single automaton
+    AdaptorScanner scanner(adaptorBases, maxMismatches, bothStrands);
+    printf("Scanning for %ld patterns\n",scanner.size());
+    if( maxMismatches ) printf("Tolerating up to %ld mismatches\n",maxMismatches);
+    if( searchWindow  ) printf("Searching within %ld bases from the 5' end%s\n",searchWindow,( searchTail ? " and from the 3' end" : ""));
+
+    // map the input file
+    SffFile sff;
+    if( sff.open(inputFileName) ) exit(0);
+    const size_t nReads = sff.size();
+
+    // the outputs start with the common header of the input but have no index
+    size_t commonHeaderLength = sff.commonHeaderLength();
+    char  *commonHeader = new char [commonHeaderLength];
+    memcpy(commonHeader, sff.commonHeader(), commonHeaderLength);
+    bzero(commonHeader+8, 12);
+
+    printf("iterating over %ld reads with %ld threads\n",nReads,nThreads);
+
+    ThreadPool pool(nThreads);
+
+    // records are independent: ranges of them are assigned in parallel
+    const size_t nRanges = (nReads + READS_PER_TASK - 1) / READS_PER_TASK;
+    std::vector<Assignment> assignments(nRanges);
+    for(size_t r=0; r<nRanges; r++)
+        pool.submit( [&,r]{
+            Assignment &assignment = assignments[r];
+            size_t end = std::min(nReads, (r+1)*READS_PER_TASK);
+            for(size_t read=r*READS_PER_TASK; read<end; read++){
+                SffRecord record = sff.record(read);
+
+                const char *bases = record.clippedBases();
+                size_t nBases = record.clippedLength();
+
+                size_t start = 0, length = 0, distance = 0;
+                size_t ind = scanner.scan(bases, nBases, policy, searchWindow, start, length, distance);
+                // the insert follows a barcode in the beginning and precedes one in the end
+                Insert insert = { (unsigned short)(start + length), (unsigned short)nBases };
+                if( ind == MAX_ADAPTORS && searchTail && searchWindow ){
+                    ind = scanner.scanTail(bases, nBases, policy, searchWindow, start, length, distance);
+                    insert.begin = 0;
+                    insert.end   = start;
+                }
+                if( ind == AdaptorScanner::AMBIGUOUS ) assignment.nAmbiguous++;
+                if( ind >= MAX_ADAPTORS ){ // no barcode
+                    ind = MAX_ADAPTORS;
+                    insert.begin = 0;
+                    insert.end   = nBases;
                 }
-            }
 
+                assignment.reads  [ind].push_back(read);
+                assignment.inserts[ind].push_back(insert);
+            }
+        } );
+    pool.wait();
+
+    // every output is written by its own task and opened with the first read of its adaptor
+    SffWriter writers[MAX_ADAPTORS+1];
+    bzero(writers, sizeof(writers));
+    if( format == SFF )
+        for(size_t a=0; a<MAX_ADAPTORS+1; a++)
+            pool.submit( [&,a]{
+                SffWriter *writer = &writers[a];
+                for(size_t r=0; r<nRanges; r++){
+                    const std::vector<unsigned int> &reads = assignments[r].reads[a];
+                    if( reads.empty() ) continue;
+                    if( !writer->file ){
+                        std::string name = outputName( ( a<MAX_ADAPTORS ? adaptorNames[a] : "noBarCode"), ".sff" );
+                        openSffWriter(writer, name.c_str(), commonHeader, commonHeaderLength);
+                    }
+                    for(size_t i=0; i<reads.size(); i++){
+                        SffRecord record = sff.record(reads[i]);
+                        fwrite(record.raw, record.rawLength, 1, writer->file);
+                    }
+                    writer->nReads += reads.size();
+                }
+                closeSffWriter(writer);
+            } );
+
+    if( format == SPLIT_FASTQ )
+        for(size_t a=0; a<MAX_ADAPTORS+1; a++)
+            pool.submit( [&,a]{
+                FastqWriter writer;
+                std::vector<char> line;
+                bool opened = false;
+                for(size_t r=0; r<nRanges; r++){
+                    const std::vector<unsigned int> &reads   = assignments[r].reads  [a];
+                    const std::vector<Insert>       &inserts = assignments[r].inserts[a];
+                    if( reads.empty() ) continue;
+                    if( !opened ){
+                        std::string name = outputName( ( a<MAX_ADAPTORS ? adaptorNames[a] : "noBarCode"), ".fastq" );
+                        if( writer.open(name.c_str()) ) exit(0);
+                        opened = true;
+                    }
+                    for(size_t i=0; i<reads.size(); i++){
+                        SffRecord record = sff.record(reads[i]);
+                        if( trimBarcodes ) writeFastq(writer, record, inserts[i].begin, inserts[i].end, line);
+                        else               writeFastq(writer, record, 0, record.clippedLength(), line);
+                    }
+                }
+                if( writer.close() ) printf("Error writing output of %s\n", ( a<MAX_ADAPTORS ? adaptorNames[a] : "noBarCode") );
+            } );
+
+    if( format == FASTQ ){
+        // path/input.sff -> <outputDir>/input.fastq
+        std::string base( inputFileName );
+        if( base.rfind('/') != std::string::npos ) base.erase(0, base.rfind('/')+1);
+        if( base.size() > 4 && base.compare(base.size()-4, 4, ".sff") == 0 ) base.resize(base.size()-4);
+        std::string name = outputName(base.c_str(), ".fastq");
+        FastqWriter writer;
+        if( writer.open(name.c_str(), false, &pool) ) exit(0);
+        std::vector<char> line;
+        for(size_t read=0; read<nReads; read++){
+            SffRecord record = sff.record(read);
+            writeFastq(writer, record, 0, record.clippedLength(), line);
         }
+        if( writer.close() ) printf("Error writing %s\n",name.c_str());
+    }
+    pool.wait();
 
-        if( !foundAdaptor ){
-            adaptorBegins[MAX_ADAPTORS][ adaptorsFound[MAX_ADAPTORS] ] = recordBegins;
-            adaptorLength[MAX_ADAPTORS][ adaptorsFound[MAX_ADAPTORS] ] = recordLength;
-            adaptorsFound[MAX_ADAPTORS]++;
-        }
+    unsigned int nAmbiguous = 0;
+    for(size_t r=0; r<nRanges; r++) nAmbiguous += assignments[r].nAmbiguous;
 
-        free(seq);
-    }
+    unsigned int nAssigned[MAX_ADAPTORS+1];
+    bzero(nAssigned, sizeof(nAssigned));
+    for(size_t r=0; r<nRanges; r++)
+        for(size_t a=0; a<MAX_ADAPTORS+1; a++) nAssigned[a] += assignments[r].reads[a].size();
 
-    // Now we need to write back sff files
-    for(size_t a=0; a<MAX_ADAPTORS+1; a++){
-        if( adaptorsFound[a] ){ //&& false ){
-            // open output file:
-            char name[MAX_LENGTH+4];
-            sprintf(name,"%s.sff", ( a<MAX_ADAPTORS ? adaptorNames[a] : "noBarCode") );
-            FILE *outputFile = NULL;
-            if( (outputFile = fopen(name,"w")) == NULL ){
-                printf("Cannot open %s\n", ( a<MAX_ADAPTORS ? adaptorNames[a] : "noBarCode") );
-                exit(0);
-            }
-            // write the common header
-            char  rawBuffer[ commonHeaderLength ];
-            fseek(inputFile, commonHeaderBegins, SEEK_SET);
-            fread(rawBuffer, commonHeaderLength, 1, inputFile);
-            // a dirty hack to correct nreads
-            uint32_t newNreads = htobe32( adaptorsFound[a] );
-            fwrite(rawBuffer, 20, 1, outputFile);
-            fwrite(&newNreads, sizeof(uint32_t), 1, outputFile);
-            fwrite(rawBuffer+20+sizeof(uint32_t), commonHeaderLength - sizeof(uint32_t) - 20, 1, outputFile);
-
-            for(size_t i=0; i<adaptorsFound[a]; i++){
-                char rawBuffer[ adaptorLength[a][i] ];
-                fseek (inputFile, adaptorBegins[a][i], SEEK_SET);
-                fread (rawBuffer, adaptorLength[a][i], 1, inputFile);
-                fwrite(rawBuffer, adaptorLength[a][i], 1, outputFile);
-            }
-            fclose(outputFile);
-        }
-        if( a<MAX_ADAPTORS && strlen(adaptorNames[a]) )
-            printf("%s: %d\n",adaptorNames[a],adaptorsFound[a]);
-    }
-    printf("noBarCode: %d\n",adaptorsFound[MAX_ADAPTORS]);
+    for(size_t a=0; a<MAX_ADAPTORS; a++)
+        if( strlen(adaptorNames[a]) )
+            printf("%s: %d\n",adaptorNames[a],nAssigned[a]);
+    printf("noBarCode: %d\n",nAssigned[MAX_ADAPTORS]);
+    printf("ambiguous: %d\n",nAmbiguous);
 
-    fclose(inputFile);
+    delete [] commonHeader;
     return 0;
 }
 
 #undef MAX_ADAPTORS
 #undef MAX_LENGTH
-
-
-
-///////// Inherited code
-#include "sff2fastq/sff.h"
-#define VERSION "0.9.0"
-#define PRG_NAME "sff2fastq"
-int trim_flag  = 1;  // trimming is enabled by default -- like 454 tools
-
-sff_common_header h;
-sff_read_header rh;
-sff_read_data rd;
-
-int readSFFcommonHeader(FILE *sff_fp){
-    read_sff_common_header(sff_fp, &h);
-    verify_sff_common_header(PRG_NAME, VERSION, &h);
-    return int(h.nreads);
-}
-
-// free_sff_common_header(&h);
-
-// read records one-by-one (it doesn't look like there is a random access functionality)
-char* readSFFrecord(FILE *sff_fp){
-    int left_clip = 0, right_clip = 0, nbases = 0;
-    char *name;
-    char *bases;
-    uint8_t *quality;
-        read_sff_read_header(sff_fp, &rh);
-        read_sff_read_data(sff_fp, &rd, h.flow_len, rh.nbases);
-
-        // get clipping points
-        get_clip_values(rh, trim_flag, &left_clip, &right_clip);
-        nbases = right_clip - left_clip;
-
-        // create bases string
-        bases = get_read_bases(rd, left_clip, right_clip);
-
-        // create quality array
-        quality = get_read_quality_values(rd, left_clip, right_clip);
-
-        // create read name string
-        int name_length = (int) rh.name_len + 1; // account for NULL termination
-        name = (char *) malloc( name_length * sizeof(char) );
-        if (!name) {
-            fprintf(stderr, "Out of memory! For read name string!\n");
-            exit(1);
-        }
-        memset(name, '\0', (size_t) name_length);
-        strncpy(name, rh.name, (size_t) rh.name_len);
-        
-        free(name);
-///        free(bases);
-        free(quality);
-        free_sff_read_header(&rh);
-        free_sff_read_data(&rd);
-
-return bases;
-}
-
@@ -0,0 +1,112 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+////////////////////// pool of worker threads //////////////////////
+
+// A fixed number of workers started once; every worker has its own queue of tasks, takes its
+//  newest task first and, when idle, steals the oldest task of another worker
+class ThreadPool {
+private:
+    struct Queue {
+        std::mutex mtx;
+        std::deque< std::function<void(void)> > tasks;
+    };
+    std::vector< std::unique_ptr<Queue> > queues;
+    std::vector< std::thread >            workers;
+
+    std::mutex              mtx;
+    std::condition_variable wakeUp;  // a task was submitted or the pool is stopping
+    std::condition_variable allDone; // no task is left queued or running
+    size_t queued;                   // tasks waiting in the queues
+    size_t pending;                  // tasks submitted but not finished yet
+    bool   stop;
+
+    std::atomic<size_t> nextQueue;   // round robin over the queues for submissions from outside
+
+    // pool and number of the worker running in this thread
+    static ThreadPool*& owner(void){ static thread_local ThreadPool *pool = 0; return pool; }
+    static size_t&      self (void){ static thread_local size_t id = 0;       return id;   }
+
+    bool pop(size_t worker, std::function<void(void)> &task){
+        for(size_t i=0; i<queues.size(); i++){
+            Queue &q = *queues[ (worker + i) % queues.size() ];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if( q.tasks.empty() ) continue;
+            if( i == 0 ){ task = std::move(q.tasks.back());  q.tasks.pop_back();  }
+            else        { task = std::move(q.tasks.front()); q.tasks.pop_front(); }
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t worker){
+        owner() = this;
+        self()  = worker;
+        while( 1 ){
+            std::function<void(void)> task;
+            if( pop(worker, task) ){
+                { std::lock_guard<std::mutex> lock(mtx); queued--; }
+                task();
+                std::lock_guard<std::mutex> lock(mtx);
+                if( --pending == 0 ) allDone.notify_all();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mtx);
+            // 'queued' is counted with the push under 'mtx', so a positive number means there is a task to find
+            wakeUp.wait(lock, [this]{ return stop || queued > 0; });
+            if( stop && queued == 0 ) return;
+        }
+    }
+
+public:
+
+    // tasks submitted from a worker go to its own queue, others are spread evenly
+    void submit(std::function<void(void)> task){
+        size_t worker = ( owner() == this ? self() : nextQueue++ % queues.size() );
+        // the task is pushed holding 'mtx', so a worker that pops it at once still cannot
+        //  uncount it (or finish it) before it is counted
+        std::lock_guard<std::mutex> lock(mtx);
+        pending++;
+        {
+            std::lock_guard<std::mutex> qlock(queues[worker]->mtx);
+            queues[worker]->tasks.push_back(std::move(task));
+        }
+        queued++;
+        wakeUp.notify_one();
+    }
+
+    // block until all submitted tasks (and the tasks they submitted) are finished
+    void wait(void){
+        std::unique_lock<std::mutex> lock(mtx);
+        allDone.wait(lock, [this]{ return pending == 0; });
+    }
+
+    size_t size(void) const { return workers.size(); }
+
+    ThreadPool(size_t nThreads):queued(0),pending(0),stop(false),nextQueue(0){
+        if( nThreads < 1 ) nThreads = 1;
+        for(size_t i=0; i<nThreads; i++) queues.push_back( std::unique_ptr<Queue>(new Queue) );
+        for(size_t i=0; i<nThreads; i++) workers.push_back( std::thread(&ThreadPool::work, this, i) );
+    }
+
+    // finishes the tasks left in the queues
+    ~ThreadPool(void){
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+        wakeUp.notify_all();
+        for(size_t i=0; i<workers.size(); i++) workers[i].join();
+    }
+};
+///////////////////////////////////////////////////////////////////////
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef TOOLBOX_H
 #define TOOLBOX_H
 #include <string.h>  // bzero,strlen 
+#include <vector>
+#include <algorithm>
 
 // Maximum length of the adaptor name and the coding sequence
 #define MAX_ADAPTORS (1024)
@@ -153,25 +155,39 @@ const unsigned NumericSequence::symbolsInOneElement = sizeof(unsigned long long)
 
 
 
-// Let us build a classical hash function around '%' operator and construct a look-up table
-//#define BUCKETS (10007)       // a moderate size prime number
-#define BUCKETS (301)         // a small prime number
-#define MAX_COLLISIONS (10)   // allow up to 100 collisions
+// Look-up table from numeric codes to the keys' indices: open addressing with linear probing in one
+//  contiguous array sized for the number of keys (at most half full), so it never overflows.
+//  Keys of different lengths share the array: a search probes every distinct key length, longest first
 class LookUpTable {
 private:
-    unsigned long long values [MAX_ADAPTORS+1];  // original values (converted keys); indexing starts from 1 
-    size_t             lengths[MAX_ADAPTORS+1];  // we should also carry around the length of original sequence in case it was ending with 'T's
-    size_t **table; //[BUCKETS][MAX_COLLISIONS]; // look-up table; stores 0 for empty buckets or an index of a potential match for a given hash value
-    size_t  *nCollisions; //[BUCKETS];           // number of collisions (should mostly be 0)
-    size_t   nValues;                            // number of elements in the lut
+    struct Slot {
+        unsigned long long code;   // key in numeric form
+        size_t             length; // of the key
+        size_t             key;    // index of the key starting from 1; 0 marks an empty slot
+    };
+    std::vector<unsigned long long> values;  // original values (converted keys); indexing starts from 1
+    std::vector<size_t>             lengths; // we should also carry around the length of original sequence in case it was ending with 'T's
+    std::vector<size_t>      keyLengths;     // distinct lengths of the keys, longest first
+    std::vector<Slot> table;
+    size_t mask, shift;                      // the top bits of a (Fibonacci) multiplicative hash select the slot
+    size_t nValues;                          // number of elements in the lut
+
+    // codes of different lengths may coincide (trailing 'T's), the length is hashed as well
+    size_t slot(unsigned long long code, size_t length) const { return ((code ^ ((unsigned long long)length<<58)) * 0x9E3779B97F4A7C15ULL) >> shift; }
+
+    static unsigned long long prefix(unsigned long long number, size_t length){
+        return length < 32 ? number & ((0x1ULL<<(length*2))-1) : number;
+    }
 
 public:
-    // performance
+    // performance: total and maximal distance of the entries from their home slots
     size_t countCollisions(size_t &maxCollisions) const {
         size_t sum = 0, max = 0;
-        for(size_t bucket=0; bucket<BUCKETS; bucket++){
-            if( max < nCollisions[bucket] ) max = nCollisions[bucket];
-            sum += nCollisions[bucket];
+        for(size_t i=0; i<table.size(); i++){
+            if( !table[i].key ) continue;
+            size_t distance = (i - slot(table[i].code, table[i].length)) & mask;
+            if( max < distance ) max = distance;
+            sum += distance;
         }
         maxCollisions = max;
         return sum;
@@ -179,131 +195,268 @@ public:
     //
     size_t size(void) const { return nValues; }
 
-    // quick search function returns MAX_ADAPTORS if requested number is not among the known keys, otherwise key index (start from 0)
+    // quick search function returns MAX_ADAPTORS if requested number is not among the known keys, otherwise key index (start from 0);
+    //  the longest key matching the beginning of the number wins and the first key in the input order wins among equal keys
     size_t find(unsigned long long number, size_t &length) const {
-        // following two lines is as far as we get most of the times
-        size_t bucket = number % BUCKETS;
-        if( table[bucket][0] == 0 ) return MAX_ADAPTORS;
-
-        // or we may have found a potential match; check if it indeed the case
-        size_t matchIndex = MAX_ADAPTORS;
-
-        // look for complete or partial match
-        size_t bestMatchLength = 0;
-        for(size_t col=0; col <= nCollisions[bucket] && matchIndex == MAX_ADAPTORS; col++){
-            size_t             ind = table[bucket][col];
-            unsigned long long val = values [ind];
-            size_t             len = lengths[ind];
-            if( (number & ((0x1LL<<(len*2))-1)) == val && bestMatchLength < len ){
-                bestMatchLength = len;
-                matchIndex = ind;
-            }
+        length = 0;
+        for(size_t l=0; l<keyLengths.size(); l++){
+            unsigned long long code = prefix(number, keyLengths[l]);
+            for(size_t i = slot(code, keyLengths[l]); table[i].key; i = (i+1) & mask)
+                if( table[i].code == code && table[i].length == keyLengths[l] ){
+                    length = keyLengths[l];
+                    return table[i].key - 1;
+                }
         }
-
-        // if match is found make the index starting from 0
-        if( matchIndex != MAX_ADAPTORS ) matchIndex--; 
-
-        length = bestMatchLength;
-
-        return matchIndex;
+        return MAX_ADAPTORS;
     }
 
     // check if any of the patterns in this LUT match any of the patterns in the reference LUT
     bool match(const LookUpTable &lut) const {
         size_t length = 0;
-//        for(size_t k=1; k<=MAX_ADAPTORS; k++)
-//            if( lengths[k] && lut.find(values[k],length)!=MAX_ADAPTORS ) break;
+        for(size_t k=1; k<lengths.size(); k++)
+            if( lengths[k] && lut.find(values[k],length)!=MAX_ADAPTORS ) return true;
+        return false;
+    }
 
-        for(size_t k=1; k<=MAX_ADAPTORS && lengths[k] && lut.find(values[k],length)==MAX_ADAPTORS; k++);
+    // construct the table from the set of keys (key's index serves the value); keys may have arbitrary lengths
+    LookUpTable(const char keys[MAX_ADAPTORS][MAX_LENGTH]):mask(0),shift(64),nValues(0){
+        size_t lastKey = 0;
+        for(size_t k=0; k<MAX_ADAPTORS; k++)
+            if( strlen( keys[k] ) ) lastKey = k+1;
 
-        if( length ) return true;
-        return false;
+        values. resize(lastKey+1, 0);
+        lengths.resize(lastKey+1, 0);
+
+        size_t tableSize = 16;
+        shift = 64 - 4;
+        while( tableSize < 2*lastKey ){ tableSize <<= 1; shift--; }
+        Slot empty = {0, 0, 0};
+        table.resize(tableSize, empty);
+        mask = tableSize - 1;
+
+        for(size_t k=0; k<lastKey; k++){
+            size_t length = strlen( keys[k] );
+            // numeric form is limited to 32 symbols
+            if( length == 0 || length > 32 ) continue;
+            unsigned short errorPos = 0;
+            unsigned long long code = sequence2number(keys[k],length,errorPos);
+            // skip any non-interpretable key
+            if( errorPos ) continue;
+            // remember the sequence in numeric form
+            lengths[k+1] = length;
+            values [k+1] = code; 
+            nValues++;
+
+            size_t i = slot(code, length);
+            while( table[i].key ) i = (i+1) & mask;
+            table[i].code   = code;
+            table[i].length = length;
+            table[i].key    = k+1;
+
+            size_t l = 0;
+            while( l < keyLengths.size() && keyLengths[l] > length ) l++;
+            if( l == keyLengths.size() || keyLengths[l] != length ) keyLengths.insert(keyLengths.begin()+l, length);
+        }
     }
+};
+
+// All codes within 'maxDistance' substitutions from a sequence of 'length' symbols in numeric form
+//  (the code itself included); there are sum_d C(length,d)*3^d of them
+void hammingNeighbours(unsigned long long code, size_t length, size_t maxDistance, std::vector<unsigned long long> &neighbours, size_t from = 0){
+    if( from == 0 ) neighbours.push_back(code);
+    if( maxDistance == 0 ) return;
+    for(size_t pos=from; pos<length; pos++)
+        for(unsigned long long symbol=1; symbol<4; symbol++){
+            unsigned long long neighbour = code ^ (symbol<<(2*pos));
+            neighbours.push_back(neighbour);
+            hammingNeighbours(neighbour, length, maxDistance-1, neighbours, pos+1);
+        }
+}
 
-    // copying constructor
-    LookUpTable(const LookUpTable &master){
-        // start with copying simple things
-        memcpy(values, master.values, sizeof(unsigned long long)*(MAX_ADAPTORS+1));
-        memcpy(lengths,master.lengths,sizeof(size_t)            *(MAX_ADAPTORS+1));
+// reverse complement of an encoded sequence: complementary bases differ in the higher bit only
+unsigned long long reverseComplement(unsigned long long code, size_t length){
+    unsigned long long retval = 0;
+    for(size_t pos=0; pos<length; pos++)
+        retval |= ( ((code>>(2*pos)) & 0x3) ^ 0x2 ) << (2*(length-1-pos));
+    return retval;
+}
 
-        // allocate and copy dynamic tables
-        nCollisions = new size_t [BUCKETS];
-        memcpy(nCollisions, master.nCollisions, sizeof(size_t)*BUCKETS);
+// Aho-Corasick automaton over the four bases: all occurrences of all keys in a read are found in a single
+//  pass, every base costs one transition. With 'maxDistance' the Hamming neighbourhoods of the keys are
+//  compiled in as well; a neighbour closer to one key than to any other stands for that key, a neighbour
+//  as close to two keys is ambiguous; with 'bothStrands' the reverse complements stand for their keys
+//  too. A policy picks one occurrence per read:
+//   FIRST_HIT - the leftmost occurrence (then the closest, then the longest)
+//   BEST_HIT  - the closest occurrence (then the longest, then the leftmost); equally good occurrences
+//               of two different keys make the read ambiguous
+class AdaptorScanner {
+public:
+    enum Policy { FIRST_HIT, BEST_HIT };
+    static const size_t AMBIGUOUS = MAX_ADAPTORS + 1;
 
-        table = new size_t* [BUCKETS];
-        for(size_t k=0; k<BUCKETS; k++){
-            table[k] = new size_t [MAX_COLLISIONS];
-            memcpy(table[k], master.table[k], sizeof(size_t)*MAX_COLLISIONS);
+private:
+    struct Pattern {
+        size_t key;      // index of the key (from 0) or AMBIGUOUS
+        size_t length;
+        size_t distance; // number of substitutions from the key
+    };
+    struct State {
+        int next[4];    // complete transition table (the failure links are folded in)
+        int pattern;    // pattern ending in this state or -1
+        int dictionary; // closest state down the failure chain with a pattern or -1
+    };
+    std::vector<State>   states;
+    std::vector<Pattern> patterns;
+    size_t maxKeyLength;
+
+    static int symbol(char c){
+        switch( c ){
+            case 'T': case 't': return 0;
+            case 'G': case 'g': return 1;
+            case 'A': case 'a': return 2;
+            case 'C': case 'c': return 3;
+            default : return -1;
         }
+    }
 
-        nValues = master.nValues;
+    int newState(void){
+        State state = {{-1,-1,-1,-1}, -1, -1};
+        states.push_back(state);
+        return states.size() - 1;
     }
 
-    // construct the table from the set of keys (key's index serves the value)
-    LookUpTable(const char keys[MAX_ADAPTORS][MAX_LENGTH]){
-        // keys may have arbitrary lengths, but the quick search function operates on the fixed length numbers
-        //  this is achieved with padding of the shorter keys to the maximal key length
-        //  in the process the shorter keys are multiplexed to all possible combinations of padding symbols
+    void insert(unsigned long long code, size_t length, size_t key, size_t distance){
+        int state = 0;
+        for(size_t pos=0; pos<length; pos++){
+            int s = (code>>(2*pos)) & 0x3;
+            if( states[state].next[s] < 0 ){
+                int created = newState();
+                states[state].next[s] = created;
+            }
+            state = states[state].next[s];
+        }
+        if( states[state].pattern < 0 ){
+            Pattern pattern = {key, length, distance};
+            states[state].pattern = patterns.size();
+            patterns.push_back(pattern);
+            return;
+        }
+        Pattern &known = patterns[ states[state].pattern ];
+        if( distance < known.distance ){ known.key = key; known.distance = distance; }
+        else if( distance == known.distance && known.key != key ) known.key = AMBIGUOUS;
+    }
 
-        // initialize static members
-        bzero(values,  sizeof(values));
-        bzero(lengths, sizeof(lengths));
+    // is the occurrence (start,pattern) ranked before the best one so far, and is it a tie
+    bool better(Policy policy, size_t start, const Pattern &p, size_t bestStart, size_t bestLength, size_t bestDistance, bool &tie) const {
+        tie = false;
+        if( policy == FIRST_HIT ){
+            if( start    != bestStart    ) return start    < bestStart;
+            if( p.distance != bestDistance ) return p.distance < bestDistance;
+            if( p.length != bestLength   ) return p.length > bestLength;
+            tie = true;
+            return false;
+        }
+        if( p.distance != bestDistance ) return p.distance < bestDistance;
+        if( p.length != bestLength   ) return p.length > bestLength;
+        tie = true;
+        return false;
+    }
 
-        // find longest key
-        size_t maxKeyLength = 0;
-        for(size_t k=0; k<MAX_ADAPTORS; k++){
-            size_t length = strlen( keys[k] );
-            if( length > maxKeyLength ) maxKeyLength = length;
+    // the part [begin, end) of the sequence is scanned and only occurrences starting before 'startLimit'
+    //  and ending after 'endLimit' count
+    size_t scan(const char *seq, size_t begin, size_t end, size_t startLimit, size_t endLimit, Policy policy,
+                size_t &start, size_t &matchLength, size_t &distance) const {
+        size_t best = MAX_ADAPTORS;
+
+        int state = 0;
+        for(size_t pos=begin; pos<end; pos++){
+            int s = symbol(seq[pos]);
+            // nothing matches across a non-interpretable symbol
+            if( s < 0 ){ state = 0; continue; }
+            state = states[state].next[s];
+            if( pos < endLimit ) continue;
+
+            for(int out = ( states[state].pattern >= 0 ? state : states[state].dictionary ); out >= 0; out = states[out].dictionary){
+                const Pattern &p = patterns[ states[out].pattern ];
+                size_t from = pos + 1 - p.length;
+                if( from >= startLimit ) continue;
+
+                bool tie = false;
+                if( best == MAX_ADAPTORS || better(policy, from, p, start, matchLength, distance, tie) ){
+                    best        = p.key;
+                    start       = from;
+                    matchLength = p.length;
+                    distance    = p.distance;
+                } else if( tie && p.key != best ) best = AMBIGUOUS;
+            }
         }
+        return best;
+    }
 
-        // allocate and initialize dynamic tables
-        nCollisions = new size_t [BUCKETS];
-        bzero(nCollisions, sizeof(size_t)*BUCKETS);
+public:
+    // returns MAX_ADAPTORS if no key is found, AMBIGUOUS or the key index; only occurrences starting
+    //  within the first 'window' symbols count (0 for the whole sequence)
+    size_t scan(const char *seq, size_t length, Policy policy, size_t window,
+                size_t &start, size_t &matchLength, size_t &distance) const {
+        if( !window ) return scan(seq, 0, length, length, 0, policy, start, matchLength, distance);
+        size_t end = std::min(length, window + maxKeyLength - 1);
+        return scan(seq, 0, end, window, 0, policy, start, matchLength, distance);
+    }
 
-        table = new size_t* [BUCKETS];
-        for(size_t k=0; k<BUCKETS; k++){
-            table[k] = new size_t [MAX_COLLISIONS];
-            bzero(table[k], sizeof(size_t)*MAX_COLLISIONS);
-        }
+    // the same at the 3' end: only occurrences ending within the last 'window' symbols count
+    size_t scanTail(const char *seq, size_t length, Policy policy, size_t window,
+                    size_t &start, size_t &matchLength, size_t &distance) const {
+        if( !window || window >= length ) return scan(seq, 0, length, length, 0, policy, start, matchLength, distance);
+        size_t begin = ( length > window + maxKeyLength - 1 ? length - window - maxKeyLength + 1 : 0 );
+        return scan(seq, begin, length, length, length - window, policy, start, matchLength, distance);
+    }
+
+    size_t size(void) const { return patterns.size(); }
 
-        nValues = 0;
+    // non-interpretable keys and keys longer than 32 symbols are skipped
+    AdaptorScanner(const char keys[MAX_ADAPTORS][MAX_LENGTH], size_t maxDistance = 0, bool bothStrands = false):maxKeyLength(0){
+        newState(); // root
 
-        // build hash values for the padded keys
+        std::vector<unsigned long long> neighbours;
         for(size_t k=0; k<MAX_ADAPTORS; k++){
             size_t length = strlen( keys[k] );
-            if( length > 0 ){
-                unsigned short errorPos = 0;
-                unsigned long long coreCode = sequence2number(keys[k],length,errorPos);
-                // skip any non-interpretable key
-                if( errorPos ) continue;
-                // remember the sequence in numeric form
-                lengths[k+1] = length;
-                values [k+1] = coreCode; 
-                nValues++;
-
-                // now create all new padding combinations and add those to the table
-                for(size_t padCode=0; padCode<(0x1<<((maxKeyLength - length)*2)); padCode++){
-                    unsigned long long code = coreCode | (padCode<<(length*2));
-                    size_t bucket = code % BUCKETS;
-                    size_t collision = 0;
-                    while( table[bucket][collision] ) collision++;
-                    table[bucket][collision] = k+1;
-                    nCollisions[bucket] = collision;
-                }
+            if( length == 0 || length > 32 ) continue;
+            unsigned short errorPos = 0;
+            unsigned long long code = sequence2number(keys[k],length,errorPos);
+            if( errorPos ) continue;
+            if( length > maxKeyLength ) maxKeyLength = length;
+
+            neighbours.clear();
+            hammingNeighbours(code, length, maxDistance, neighbours);
+            for(size_t n=0; n<neighbours.size(); n++){
+                size_t distance = 0;
+                for(unsigned long long diff = neighbours[n] ^ code; diff; diff >>= 2) distance += ( (diff & 0x3) != 0 );
+                insert(neighbours[n], length, k, distance);
+                if( bothStrands ) insert(reverseComplement(neighbours[n], length), length, k, distance);
             }
         }
-    }
 
-    ~LookUpTable(void){
-        for(size_t k=0; k<BUCKETS; k++)
-            delete [] table[k];
-        delete [] table;
-        delete [] nCollisions;
+        // breadth-first: failure links point to shallower states, so those are complete already
+        std::vector<int> failure(states.size(), 0), queue;
+        for(int s=0; s<4; s++){
+            int child = states[0].next[s];
+            if( child < 0 ) states[0].next[s] = 0;
+            else queue.push_back(child);
+        }
+        for(size_t head=0; head<queue.size(); head++){
+            int state = queue[head];
+            int fail  = failure[state];
+            states[state].dictionary = ( states[fail].pattern >= 0 ? fail : states[fail].dictionary );
+            for(int s=0; s<4; s++){
+                int child = states[state].next[s];
+                if( child < 0 ){ states[state].next[s] = states[fail].next[s]; continue; }
+                failure[child] = states[fail].next[s];
+                queue.push_back(child);
+            }
+        }
     }
 };
 
-///#undef MAX_COLLISIONS
-///#undef BUCKETS
 
 //#undef MAX_ADAPTORS
 //#undef MAX_LENGTH
@@ -44,6 +44,7 @@ int main(int argc, char *argv[]){
 
     DNASequencing worker;
     worker.initTest(0); // here we may optimize for k-mers sizes, hash table parameters, etc.
+    worker.initMemory(IndexArena::TRANSPARENT_HUGE_PAGES, IndexArena::INTERLEAVE_NODES);
 
 { // save some space by getting rid of the local container on leaving the scope once we hand over the results to DNASequencing worker
     vector<string> chromatidSequence[24];
@@ -155,6 +156,8 @@ int main(int argc, char *argv[]){
         vector<string> qwe = worker.getAlignment(18*2, 0, 0, readName[readFileId], readSequence[readFileId]);
     }
 
+    worker.dumpStats(cout);
+
 
     return 0;
 }
@@ -0,0 +1,179 @@
+#ifndef UNIONFIND_H
+#define UNIONFIND_H
+#include <vector>
+#include <atomic>
+
+////////////////////// union-find data structure //////////////////////
+
+// Disjoint sets over the nodes numbered [begin, end) kept in two contiguous arrays (parent and rank);
+//  path halving and union by rank make findCluster and joinClusters practically constant time
+class UnionFind {
+public:
+    // members of one cluster: a range in the array of all nodes grouped by their clusters
+    struct Cluster {
+        int leader;
+        const int *first, *last;
+        const int* begin(void) const { return first; }
+        const int* end  (void) const { return last;  }
+        size_t     size (void) const { return last - first; }
+    };
+
+private:
+    std::vector<int>           parent; // parent[node-offset]; a root is its own parent
+    std::vector<unsigned char> rank;   // upper bound of the tree height, meaningful for roots only
+    int    offset;                     // number of the first node
+    size_t nSets;
+
+    // member lists are only built when requested and invalidated by every join
+    mutable std::vector<int>     members;
+    mutable std::vector<Cluster> index;
+    mutable bool                 upToDate;
+
+    int root(int i) const {
+        while( parent[i] != i ) i = parent[i];
+        return i;
+    }
+
+public:
+
+    int findCluster(int node){
+        int i = node - offset;
+        while( parent[i] != i ){
+            parent[i] = parent[ parent[i] ]; // path halving
+            i = parent[i];
+        }
+        return i + offset;
+    }
+
+    // returns the new leader of the joined cluster
+    int joinClusters(int cluster1, int cluster2){
+        int i = findCluster(cluster1) - offset;
+        int j = findCluster(cluster2) - offset;
+        if( i == j ) return i + offset;
+        if( rank[i] < rank[j] ){ int tmp = i; i = j; j = tmp; }
+        parent[j] = i;
+        if( rank[i] == rank[j] ) rank[i]++;
+        nSets--;
+        upToDate = false;
+        return i + offset;
+    }
+
+    int nClusters(void) const { return nSets; }
+
+    // clusters ordered by the leader's number; the ranges stay valid until the next join
+    const std::vector<Cluster>& clusters(void) const {
+        if( upToDate ) return index;
+        std::vector<int> roots(parent.size());
+        for(size_t i=0; i<roots.size(); i++) roots[i] = root(i);
+        groupByRoots(roots, offset, members, index);
+        upToDate = true;
+        return index;
+    }
+
+    // counting sort of the nodes by their roots (i.e. roots[i] for node i+offset)
+    static void groupByRoots(const std::vector<int> &roots, int offset, std::vector<int> &members, std::vector<Cluster> &index){
+        const size_t n = roots.size();
+        std::vector<int> first(n+1, 0);
+        for(size_t i=0; i<n; i++) first[ roots[i]+1 ]++;
+        for(size_t i=0; i<n; i++) first[i+1] += first[i];
+
+        members.resize(n);
+        std::vector<int> next(first.begin(), first.end()-1);
+        for(size_t i=0; i<n; i++) members[ next[ roots[i] ]++ ] = i + offset;
+
+        index.clear();
+        for(size_t i=0; i<n; i++){
+            if( roots[i] != int(i) ) continue;
+            Cluster c;
+            c.leader = i + offset;
+            c.first  = members.data() + first[i];
+            c.last   = members.data() + first[i+1];
+            index.push_back(c);
+        }
+    }
+
+    // nodes [begin, end)
+    UnionFind(int begin, int end):offset(begin),nSets(0),upToDate(false){
+        if( end < begin ) end = begin;
+        parent.resize(end-begin);
+        rank.  resize(end-begin, 0);
+        for(int i=0; i<end-begin; i++) parent[i] = i;
+        nSets = end - begin;
+    }
+
+    // nodes [1, maxNodes]
+    UnionFind(int maxNodes):UnionFind(1, maxNodes+1){}
+};
+
+// The same disjoint sets shared by many threads without locks: a root is linked under another root
+//  with a compare-and-swap on its parent (the smaller number wins, so the leader is the smallest member)
+//  and findCluster halves paths with the same operation, so it never waits for other threads
+class ConcurrentUnionFind {
+public:
+    typedef UnionFind::Cluster Cluster;
+
+private:
+    std::vector< std::atomic<int> > parent;
+    int offset;
+
+    mutable std::vector<int>     members;
+    mutable std::vector<Cluster> index;
+
+public:
+
+    int findCluster(int node){
+        int i = node - offset;
+        while( 1 ){
+            int p = parent[i].load();
+            if( p == i ) return i + offset;
+            int gp = parent[p].load();
+            // a failure means another thread has already moved the node up
+            if( gp != p ) parent[i].compare_exchange_weak(p, gp);
+            i = gp;
+        }
+    }
+
+    // returns the new leader of the joined cluster
+    int joinClusters(int cluster1, int cluster2){
+        while( 1 ){
+            int i = findCluster(cluster1) - offset;
+            int j = findCluster(cluster2) - offset;
+            if( i == j ) return i + offset;
+            if( i > j ){ int tmp = i; i = j; j = tmp; }
+            // link only if 'j' is still a root, otherwise some thread got there first: start over
+            int expected = j;
+            if( parent[j].compare_exchange_strong(expected, i) ) return i + offset;
+        }
+    }
+
+    // call the functions below only when no thread is joining the clusters anymore
+
+    int nClusters(void) const {
+        int n = 0;
+        for(size_t i=0; i<parent.size(); i++) n += ( parent[i].load() == int(i) );
+        return n;
+    }
+
+    // clusters ordered by the leader's number
+    const std::vector<Cluster>& clusters(void) const {
+        std::vector<int> roots(parent.size());
+        for(size_t i=0; i<roots.size(); i++){
+            int r = i;
+            while( parent[r].load() != r ) r = parent[r].load();
+            roots[i] = r;
+        }
+        UnionFind::groupByRoots(roots, offset, members, index);
+        return index;
+    }
+
+    // nodes [begin, end)
+    ConcurrentUnionFind(int begin, int end):parent(end > begin ? end - begin : 0),offset(begin){
+        for(size_t i=0; i<parent.size(); i++) parent[i].store(i);
+    }
+
+    // nodes [1, maxNodes]
+    ConcurrentUnionFind(int maxNodes):ConcurrentUnionFind(1, maxNodes+1){}
+};
+///////////////////////////////////////////////////////////////////////
+
+#endif